@@ -0,0 +1,117 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <xec/TaskExecutor.hpp>
+#include <xec/SimulatedExecution.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Throughput of cancelling and expiring tasks of a TaskExecutor
+// Each case reports the best of several runs. Use a release build and an otherwise idle machine
+
+namespace {
+
+using task_id = xec::TaskExecutor::task_id;
+
+constexpr int NumRuns = 7;
+
+class Stopwatch {
+public:
+    double ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+};
+
+// the function sets its case up and returns the time of the measured part
+template <typename F>
+void bench(const char* name, F f) {
+    double best = f();
+    for (int i = 1; i < NumRuns; ++i) {
+        best = std::min(best, f());
+    }
+    std::printf("%-48s %9.2f ms\n", name, best);
+}
+
+std::minstd_rand rng(42);
+
+}
+
+int main() {
+    bench("cancel 20k queued tasks by id, random order", [] {
+        xec::TaskExecutor executor;
+        int n = 0;
+        std::vector<task_id> ids;
+        for (int i = 0; i < 20'000; ++i) {
+            ids.push_back(executor.pushTask([&] { ++n; }));
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        Stopwatch sw;
+        for (auto id : ids) {
+            executor.cancelTask(id);
+        }
+        return sw.ms();
+    });
+
+    bench("cancel 20k timed tasks by id, random order", [] {
+        xec::TaskExecutor executor;
+        int n = 0;
+        std::vector<task_id> ids;
+        {
+            auto t = executor.taskLocker();
+            for (int i = 0; i < 20'000; ++i) {
+                ids.push_back(t.scheduleTask(xec::ms_t(1000 + i), [&] { ++n; }));
+            }
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        Stopwatch sw;
+        for (auto id : ids) {
+            executor.cancelTask(id);
+        }
+        return sw.ms();
+    });
+
+    bench("cancel 40k queued tasks by 100 tokens", [] {
+        xec::TaskExecutor executor;
+        int n = 0;
+        {
+            auto t = executor.taskLocker();
+            for (int i = 0; i < 40'000; ++i) {
+                t.pushTask([&] { ++n; }, i % 100 + 1);
+            }
+        }
+
+        Stopwatch sw;
+        for (int token = 1; token <= 100; ++token) {
+            executor.cancelTasksWithToken(token);
+        }
+        return sw.ms();
+    });
+
+    bench("expire 200k timed tasks (virtual time)", [] {
+        xec::TaskExecutor executor;
+        xec::SimulatedExecution sim(executor);
+        sim.runUntilIdle();
+        int n = 0;
+        std::uniform_int_distribution<int> delay(1, 10'000);
+        {
+            auto t = executor.taskLocker();
+            for (int i = 0; i < 200'000; ++i) {
+                t.scheduleTask(xec::ms_t(delay(rng)), [&] { ++n; });
+            }
+        }
+
+        Stopwatch sw;
+        sim.runUntilIdle();
+        return sw.ms();
+    });
+
+    return 0;
+}
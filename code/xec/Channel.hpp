@@ -0,0 +1,173 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ExecutorBase.hpp"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace xec {
+
+// A bounded typed queue of messages from any number of producers to a single consuming executor
+// Pushing a message doesn't allocate or lock, and it only wakes the consumer up when the channel goes from
+// empty to non-empty. Thus a burst of messages costs a single wake up and is drained in batches by the consumer
+// (typically in its update)
+//
+// The consumer must drain until it gets an empty channel (or until the limit of drain), as this is what arms the
+// wake up for the next message. If it stops draining early, it's not woken up for the remaining messages.
+//
+// WARNING: the channel must outlive the use of its producer and consumer functions
+template <typename T>
+class Channel {
+public:
+    // the capacity is rounded up to a power of two
+    Channel(ExecutorBase& consumer, size_t capacity)
+        : m_consumer(consumer)
+    {
+        size_t cap = 2;
+        while (cap < capacity) cap *= 2;
+        m_mask = cap - 1;
+        m_slots.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~Channel() {
+        // destroy messages which were never consumed
+        while (tryPop());
+    }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // producer side
+    // valid on any thread
+    // return false if the channel is full (the message is not consumed in this case)
+
+    bool tryPush(T&& msg) { return tryEmplace(std::move(msg)); }
+    bool tryPush(const T& msg) { return tryEmplace(msg); }
+
+    template <typename... Args>
+    bool tryEmplace(Args&&... args) {
+        // claim a slot (as in Dmitry Vyukov's bounded MPMC queue)
+        Slot* slot;
+        auto pos = m_pushPos.load(std::memory_order_relaxed);
+        while (true) {
+            slot = &m_slots[pos & m_mask];
+            const auto seq = slot->seq.load(std::memory_order_acquire);
+            const auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false; // full
+            }
+            else {
+                pos = m_pushPos.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (slot->buf) T(std::forward<Args>(args)...);
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        // pairs with the fence in rearm: either we see the armed flag, or the consumer sees our message
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_armed.load(std::memory_order_relaxed) && m_armed.exchange(false, std::memory_order_relaxed)) {
+            m_consumer.wakeUpNow();
+        }
+
+        return true;
+    }
+
+    // consumer side
+    // only valid on the thread of the consumer (typically in its update)
+
+    // call f(T&) for at most maxMessages messages and return the number of consumed messages
+    // if the limit is reached before the channel is empty, the consumer is woken up again, so it can continue
+    // in its next update, otherwise the wake up is armed as if the channel was drained until empty
+    template <typename F>
+    size_t drain(F&& f, size_t maxMessages = size_t(-1)) {
+        size_t ret = 0;
+        while (ret < maxMessages) {
+            if (!popInto(f)) return ret;
+            ++ret;
+        }
+        if (rearm()) {
+            // there are more messages, but we're not armed, so no producer will wake us up for them
+            m_consumer.wakeUpNow();
+        }
+        return ret;
+    }
+
+    std::optional<T> tryPop() {
+        std::optional<T> ret;
+        popInto([&](T& msg) { ret.emplace(std::move(msg)); });
+        return ret;
+    }
+
+    bool empty() const {
+        return m_slots[m_popPos & m_mask].seq.load(std::memory_order_acquire) != m_popPos + 1;
+    }
+
+private:
+    ExecutorBase& m_consumer;
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        alignas(T) std::byte buf[sizeof(T)];
+        T& msg() { return *std::launder(reinterpret_cast<T*>(buf)); }
+    };
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+
+    // producer and consumer state in separate cache lines
+    alignas(64) std::atomic<size_t> m_pushPos = 0;
+    alignas(64) size_t m_popPos = 0;
+
+    // set by the consumer when it finds the channel empty
+    // the first producer which clears it wakes the consumer up
+    // initially the consumer is waiting for messages
+    std::atomic_bool m_armed = true;
+
+    template <typename F>
+    bool popInto(F&& f) {
+        auto& slot = m_slots[m_popPos & m_mask];
+        if (slot.seq.load(std::memory_order_acquire) != m_popPos + 1) {
+            // empty
+            if (!rearm()) return false;
+        }
+
+        auto& msg = slot.msg();
+        f(msg);
+        msg.~T();
+        slot.seq.store(m_popPos + m_mask + 1, std::memory_order_release);
+        ++m_popPos;
+        return true;
+    }
+
+    // arm the wake up and return true if a message has arrived in the meantime
+    bool rearm() {
+        if (m_armed.load(std::memory_order_relaxed)) return false; // already armed
+
+        m_armed.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty()) return false;
+
+        // a producer has pushed before seeing the flag
+        // if it's still set, we can take the message, otherwise a producer has seen the flag and woke us up
+        // either way we can take the message (the extra wake up is harmless)
+        m_armed.store(false, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+}
@@ -0,0 +1,218 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "EpollExecution.hpp"
+
+#include "ExecutorBase.hpp"
+
+#include "bits/EventFd.hpp"
+#include "bits/update.hpp"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <limits>
+#include <system_error>
+
+namespace xec {
+
+namespace {
+constexpr int MaxEventsPerWait = 64;
+}
+
+EpollExecutionContext::EpollExecutionContext()
+    : m_running(true)
+    , m_wakeUpFd(std::make_unique<EventFd>())
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_hasWork(true)
+{
+    if (m_epollFd < 0) throw std::system_error(errno, std::system_category(), "epoll_create1");
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // null data identifies the wake up fd
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeUpFd->fd(), &ev) != 0) {
+        auto err = errno;
+        close(m_epollFd);
+        throw std::system_error(err, std::system_category(), "epoll_ctl");
+    }
+}
+
+EpollExecutionContext::~EpollExecutionContext() {
+    close(m_epollFd);
+}
+
+void EpollExecutionContext::stop() {
+    m_running = false;
+    wakeUpNow();
+}
+
+void EpollExecutionContext::wakeUpNow() {
+    bool signal;
+    {
+        std::lock_guard<std::mutex> lk(m_workMutex);
+        if (m_hasWork) return; // already woken up
+        m_hasWork = true;
+        signal = m_waiting;
+    }
+
+    // if we're not waiting, the work will be seen before the next epoll_wait, so we spare the syscall
+    if (signal) {
+        m_wakeUpFd->signal();
+    }
+}
+
+void EpollExecutionContext::scheduleNextWakeUp(ms_t timeFromNow) {
+    bool signal;
+    {
+        std::lock_guard<std::mutex> lk(m_workMutex);
+        m_scheduledWakeUpTime = clock_t::now() + timeFromNow;
+        signal = m_waiting; // we need to wake up to update the timeout of epoll_wait
+    }
+    if (signal) {
+        m_wakeUpFd->signal();
+    }
+}
+
+void EpollExecutionContext::unscheduleNextWakeUp() {
+    // no need to signal
+    // if we wake up from the old timeout, we will see that there's nothing to do and wait again
+    std::lock_guard<std::mutex> lk(m_workMutex);
+    m_scheduledWakeUpTime.reset();
+}
+
+bool EpollExecutionContext::addFd(int fd, uint32_t events, FdCallback callback) {
+    auto watch = std::make_unique<Watch>();
+    watch->fd = fd;
+    watch->callback = std::move(callback);
+
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = watch.get();
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) return false;
+
+    m_watches[fd] = std::move(watch);
+    return true;
+}
+
+bool EpollExecutionContext::modifyFd(int fd, uint32_t events) {
+    auto f = m_watches.find(fd);
+    if (f == m_watches.end()) return false;
+
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = f->second.get();
+    return epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool EpollExecutionContext::removeFd(int fd) {
+    auto f = m_watches.find(fd);
+    if (f == m_watches.end()) return false;
+
+    auto ret = epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr) == 0;
+
+    // we might be in the middle of a dispatch and there may be pending events for this watch
+    // so keep it alive until the dispatch is over, but make sure it won't be called
+    f->second->callback = {};
+    m_removedWatches.push_back(std::move(f->second));
+    m_watches.erase(f);
+    return ret;
+}
+
+void EpollExecutionContext::wait() {
+    epoll_event events[MaxEventsPerWait];
+
+    while (true) {
+        int timeout = -1; // wait indefinitely
+        {
+            std::lock_guard<std::mutex> lk(m_workMutex);
+            if (m_hasWork) {
+                // we have work, but still check the fds without blocking
+                timeout = 0;
+            }
+            else if (m_scheduledWakeUpTime) {
+                auto toWait = *m_scheduledWakeUpTime - clock_t::now();
+                // round up, so we don't wake up before the scheduled time
+                // and clamp, as a wake up which is more than ~24 days away doesn't fit in the timeout
+                // (we will just wait again when it expires)
+                const auto ms = std::chrono::ceil<ms_t>(toWait).count();
+                timeout = int(std::clamp<ms_t::rep>(ms, 0, std::numeric_limits<int>::max()));
+            }
+            m_waiting = timeout != 0;
+        }
+
+        const int n = epoll_wait(m_epollFd, events, MaxEventsPerWait, timeout);
+
+        bool ready = false;
+        {
+            std::lock_guard<std::mutex> lk(m_workMutex);
+            m_waiting = false;
+            if (m_hasWork) {
+                m_hasWork = false;
+                m_scheduledWakeUpTime.reset(); // forget about scheduling wakeup if we were woken up with work to do
+                ready = true;
+            }
+            else if (m_scheduledWakeUpTime && *m_scheduledWakeUpTime <= clock_t::now()) {
+                m_scheduledWakeUpTime.reset(); // timer was consumed
+                ready = true;
+            }
+        }
+
+        // n is negative on errors (most likely EINTR), in which case we just loop again
+        for (int i = 0; i < n; ++i) {
+            auto watch = static_cast<Watch*>(events[i].data.ptr);
+            if (!watch) {
+                // the wake up fd
+                // the state it signals has already been checked above
+                m_wakeUpFd->drain();
+                continue;
+            }
+
+            if (!watch->callback) continue; // removed while dispatching
+            watch->callback(events[i].events);
+
+            // the callback might have pushed tasks, but it might also have just read something
+            // in any case the executor should be updated
+            ready = true;
+        }
+        m_removedWatches.clear();
+
+        if (ready) return;
+
+        // otherwise this is a wake up which changed the scheduled time, or a spurious one
+        // so we loop again
+    }
+}
+
+EpollExecution::EpollExecution(ExecutorBase& e)
+    : m_executor(e)
+{
+    auto ctx = std::make_unique<EpollExecutionContext>();
+    m_context = ctx.get();
+    m_executor.setExecutionContext(std::move(ctx));
+}
+
+EpollExecution::~EpollExecution() {
+    stopAndJoinThread();
+}
+
+void EpollExecution::run() {
+    runExecutionLoop(*m_context, m_executor);
+}
+
+void EpollExecution::launchThread(std::optional<std::string_view> threadName) {
+    m_thread.launch([this] { run(); }, threadName);
+}
+
+void EpollExecution::joinThread() {
+    m_thread.join();
+}
+
+void EpollExecution::stopAndJoinThread() {
+    m_executor.stop();
+    joinThread();
+}
+
+}
@@ -0,0 +1,107 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ExecutionContext.hpp"
+#include "bits/ExecutionThread.hpp"
+
+#include <itlib/ufunction.hpp>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+// linux only
+
+namespace xec {
+
+class EventFd;
+
+// An execution context which serves file descriptor readiness, wake ups and scheduled wake ups
+// from a single thread with a single epoll_wait per iteration
+// wakeUpNow signals an eventfd and the next scheduled wake up is the timeout of epoll_wait
+class XEC_API EpollExecutionContext final : public ExecutionContext {
+public:
+    EpollExecutionContext();
+    ~EpollExecutionContext();
+
+    // run status
+    // both funcs are safe to call from any thread
+    virtual bool running() const override { return m_running; }
+    virtual void stop() override;
+
+    // wakes up from waiting
+    // safe to call from any thread
+    // safe to call no matter if the executable is waiting or not
+    void wakeUpNow() override;
+
+    // shedule a wake up
+    // safe to call from any thread
+    // safe to call no matter if the executable is waiting or not
+    void scheduleNextWakeUp(ms_t timeFromNow) override;
+    void unscheduleNextWakeUp() override;
+
+    // file descriptor readiness
+    // events are epoll events (EPOLLIN, EPOLLOUT...)
+    // the callback is invoked in wait() on the execution thread with the events which are ready
+    // (thus right before the executor is updated, so it's a good place to push tasks to it)
+    // these functions are only valid on the execution thread or before it's launched
+    // return false if the underlying epoll_ctl fails (check errno for details)
+    using FdCallback = itlib::ufunction<void(uint32_t events)>;
+    bool addFd(int fd, uint32_t events, FdCallback callback);
+    bool modifyFd(int fd, uint32_t events);
+    bool removeFd(int fd);
+
+    // call at the beginning of each frame
+    // will block until woken up, a scheduled wake up time is reached, or a file descriptor is ready
+    void wait();
+
+private:
+    std::atomic_bool m_running;
+
+    std::unique_ptr<EventFd> m_wakeUpFd;
+    int m_epollFd;
+
+    // wait state
+    bool m_hasWork;
+    bool m_waiting = false; // in epoll_wait with a non-zero timeout, so we need to signal to wake up
+    std::optional<clock_t::time_point> m_scheduledWakeUpTime;
+    std::mutex m_workMutex;
+
+    struct Watch {
+        int fd;
+        FdCallback callback;
+    };
+    std::unordered_map<int, std::unique_ptr<Watch>> m_watches;
+
+    // watches removed while dispatching events are kept alive until the dispatch is done
+    std::vector<std::unique_ptr<Watch>> m_removedWatches;
+};
+
+class XEC_API EpollExecution {
+public:
+    // call the following on the main thread
+    EpollExecution(ExecutorBase& e);
+    ~EpollExecution();
+
+    EpollExecutionContext& context() { return *m_context; }
+
+    void run(); // blocks current thread with the execution loop
+
+    void launchThread(std::optional<std::string_view> threadName = std::nullopt);
+    void joinThread(); // Wait for thread to join. WARNING: unless someone stops the execution, this will wait indefinitely!
+    void stopAndJoinThread(); // Stop the execution and wait for join
+
+    std::thread::id threadId() const { return m_thread.id(); }
+private:
+    ExecutorBase& m_executor;
+    EpollExecutionContext* m_context = nullptr;
+    ExecutionThread m_thread;
+};
+
+}
@@ -29,6 +29,10 @@ protected:
 
     // check if context is running
     virtual bool running() const = 0;
+
+    // the current time as seen by the executor
+    // all scheduling is relative to this, so contexts can provide a clock of their own (say virtual time)
+    virtual clock_t::time_point now() const { return clock_t::now(); }
 };
 
 }
@@ -4,6 +4,9 @@
 #include "ExecutorBase.hpp"
 #include "ExecutionContext.hpp"
 
+#include "bits/trace.hpp"
+#include "bits/hooks.hpp"
+
 #include <cassert>
 #include <optional>
 
@@ -70,11 +73,23 @@ void ExecutorBase::setExecutionContext(std::unique_ptr<ExecutionContext> context
     m_initialContext = nullptr;
 }
 
+std::unique_ptr<ExecutionContext> ExecutorBase::detachExecutionContext() {
+    assert(!m_initialContext); // nothing to detach
+    auto ret = std::move(m_executionContext);
+    m_executionContext = std::make_unique<InitialContext>();
+    m_initialContext = static_cast<InitialContext*>(m_executionContext.get());
+    return ret;
+}
+
 void ExecutorBase::wakeUpNow() {
+    XEC_TRACE(WakeUpNow, this, 0, 0);
+    Hooks::onWakeUp(*this);
     m_executionContext->wakeUpNow();
 }
 
 void ExecutorBase::scheduleNextWakeUp(ms_t timeFromNow) {
+    XEC_TRACE(ScheduleWakeUp, this, timeFromNow.count(), 0);
+    Hooks::onScheduleWakeUp(*this, timeFromNow);
     m_executionContext->scheduleNextWakeUp(timeFromNow);
 }
 
@@ -86,6 +101,10 @@ void ExecutorBase::stop() {
     m_executionContext->stop();
 }
 
+clock_t::time_point ExecutorBase::now() const {
+    return m_executionContext->now();
+}
+
 // export ExecutionContext vtable;
 ExecutionContext::~ExecutionContext() = default;
 
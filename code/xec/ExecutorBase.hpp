@@ -5,10 +5,12 @@
 #include "API.h"
 #include "bits/chrono.hpp"
 #include <memory>
+#include <atomic>
 
 namespace xec {
 
 class ExecutionContext;
+class Heartbeat;
 
 class XEC_API ExecutorBase {
 public:
@@ -27,12 +29,35 @@ public:
 
     const ExecutionContext& executionContext() const { return *m_executionContext; }
 
+    // detach the current execution context and return the executor to its initial state
+    // wake ups requested after this are stored and transferred to the next context set with setExecutionContext
+    // returns the detached context
+    // used by executions which release an executor without stopping it
+    // WARNING: not thread safe. No other thread must use the executor while its context is being detached
+    std::unique_ptr<ExecutionContext> detachExecutionContext();
+
     // proxies to the execution context
     void wakeUpNow();
     void scheduleNextWakeUp(ms_t timeFromNow);
     void unscheduleNextWakeUp();
     void stop();
+    clock_t::time_point now() const;
+
+    // latency target: the desired maximum time from a wake up to the update which serves it
+    // used by executions which dispatch by deadline (see PoolExecution::DispatchPolicy)
+    // a zero target (the default) means none
+    // valid on any thread
+    void setLatencyTarget(ms_t target) { m_latencyTarget.store(target.count(), std::memory_order_relaxed); }
+    ms_t latencyTarget() const { return ms_t(m_latencyTarget.load(std::memory_order_relaxed)); }
+
+    // progress markers for stall detection (see Watchdog.hpp)
+    // null unless the executor is watched
+    Heartbeat* heartbeat() const { return m_heartbeat.load(std::memory_order_acquire); }
+    void setHeartbeat(Heartbeat* heartbeat) { m_heartbeat.store(heartbeat, std::memory_order_release); }
 private:
+    std::atomic<Heartbeat*> m_heartbeat = nullptr;
+    std::atomic<ms_t::rep> m_latencyTarget = 0;
+
     std::unique_ptr<ExecutionContext> m_executionContext; // never null
 
     // potentially points to a custom oneshot execution context which is used
@@ -0,0 +1,59 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "bits/chrono.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace xec {
+
+// Progress markers of an executor observed by a Watchdog
+// Written only by the thread which updates the executor and read by the watchdog thread
+// Execution loops mark updates and TaskExecutor marks its tasks
+// Custom executors can mark their own units of work as tasks
+class Heartbeat {
+public:
+    void beginUpdate() noexcept { m_updateStart.store(now(), std::memory_order_release); }
+    void endUpdate() noexcept { m_updateStart.store(0, std::memory_order_release); }
+
+    void beginTask(uint32_t id, uint32_t ctoken) noexcept {
+        m_taskId.store(id, std::memory_order_release);
+        m_taskCToken.store(ctoken, std::memory_order_release);
+        m_taskStart.store(now(), std::memory_order_release);
+    }
+    void endTask() noexcept { m_taskStart.store(0, std::memory_order_release); }
+
+    // start times are zero when not in an update or task
+    struct Snapshot {
+        int64_t updateStart;
+        int64_t taskStart;
+        uint32_t taskId;
+        uint32_t taskCToken;
+    };
+
+    // read a consistent snapshot
+    // return false if the executor moved to another task while reading (thus it's clearly not stalled)
+    bool read(Snapshot& s) const noexcept {
+        s.updateStart = m_updateStart.load(std::memory_order_acquire);
+        s.taskStart = m_taskStart.load(std::memory_order_acquire);
+        s.taskId = m_taskId.load(std::memory_order_acquire);
+        s.taskCToken = m_taskCToken.load(std::memory_order_acquire);
+        // if we've read the id or token of a newer task, we will also see that the start has changed
+        return m_taskStart.load(std::memory_order_acquire) == s.taskStart;
+    }
+
+    // time in ns since the clock epoch
+    static int64_t now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now().time_since_epoch()).count();
+    }
+
+private:
+    std::atomic<int64_t> m_updateStart = 0;
+    std::atomic<int64_t> m_taskStart = 0;
+    std::atomic_uint32_t m_taskId = 0;
+    std::atomic_uint32_t m_taskCToken = 0;
+};
+
+}
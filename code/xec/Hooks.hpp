@@ -0,0 +1,60 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "TaskProfiling.hpp" // TaskSite
+#include "bits/chrono.hpp"
+
+#include <cstdint>
+
+// Compile-time instrumentation hooks
+//
+// The library calls static functions of a hooks type around every update and task (including the tasks of strands),
+// when tasks are enqueued, and on wake up requests. By default it's DefaultHooks below, whose functions are empty and inline,
+// so the hooks compile to nothing
+//
+// To attach your own instrumentation (say RDTSC counters or allocation tracking), build the library with
+// XEC_HOOKS_HEADER (cmake option) set to a header which:
+// * includes this one
+// * defines a type which inherits from DefaultHooks and hides the functions it needs
+// * defines XEC_HOOKS as the name of the type
+// (test/CountingHooks.hpp is an example)
+// The header is only included in the library's sources, so if the hooks call out to another library,
+// it must be linked to xec
+//
+// Hooks are called on the thread which does the work (the execution thread for updates and tasks,
+// the producer for enqueues) and must be thread safe. Enqueue hooks may be called while the tasks are locked
+
+namespace xec {
+
+class ExecutorBase;
+class TaskExecutor;
+class Strand;
+
+struct DefaultHooks {
+    // around ExecutorBase::update in the execution loops
+    static void beforeUpdate(const ExecutorBase&) {}
+    static void afterUpdate(const ExecutorBase&) {}
+
+    // around each task of a TaskExecutor
+    // queued tasks only keep their site if they were pushed while task profiling was enabled (see TaskProfiling.hpp)
+    // otherwise it's empty here, unless keepTaskSites is true (at the cost of some memory per task)
+    static constexpr bool keepTaskSites = false;
+    static void beforeTask(const TaskExecutor&, uint32_t /*id*/, uint32_t /*ctoken*/, const TaskSite&) {}
+    static void afterTask(const TaskExecutor&, uint32_t /*id*/, uint32_t /*ctoken*/, const TaskSite&) {}
+
+    // a task was pushed or scheduled to a TaskExecutor (the delay is 0 for immediate tasks)
+    static void onEnqueue(const TaskExecutor&, uint32_t /*id*/, uint32_t /*ctoken*/, const TaskSite&, ms_t /*delay*/) {}
+
+    // the same for strands, whose tasks have no ids, tokens, or sites
+    // the tasks are executed by the workers of the strand's pool
+    static void beforeStrandTask(const Strand&) {}
+    static void afterStrandTask(const Strand&) {}
+    static void onStrandPost(const Strand&) {}
+
+    // wake up requests to an executor (ExecutorBase::wakeUpNow and ExecutorBase::scheduleNextWakeUp)
+    static void onWakeUp(const ExecutorBase&) {}
+    static void onScheduleWakeUp(const ExecutorBase&, ms_t /*timeFromNow*/) {}
+};
+
+}
@@ -0,0 +1,150 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "PollableExecution.hpp"
+
+#include "ExecutorBase.hpp"
+
+#include "bits/EventFd.hpp"
+#include "bits/update.hpp"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+namespace xec {
+
+namespace {
+void addToEpoll(int epollFd, int fd) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+}
+}
+
+PollableExecutionContext::PollableExecutionContext()
+    : m_running(true)
+    , m_hasWork(true)
+    , m_wakeUpFd(std::make_unique<EventFd>())
+    , m_timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    , m_epollFd(-1)
+{
+    // clock_t is std::chrono::steady_clock which is based on CLOCK_MONOTONIC,
+    // so its time points can be used with the timerfd directly
+
+    if (m_timerFd < 0) throw std::system_error(errno, std::system_category(), "timerfd_create");
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        auto err = errno;
+        close(m_timerFd);
+        throw std::system_error(err, std::system_category(), "epoll_create1");
+    }
+
+    try {
+        addToEpoll(m_epollFd, m_wakeUpFd->fd());
+        addToEpoll(m_epollFd, m_timerFd);
+    }
+    catch (...) {
+        close(m_epollFd);
+        close(m_timerFd);
+        throw;
+    }
+
+    // we start with work, so the fd should be readable
+    m_wakeUpFd->signal();
+}
+
+PollableExecutionContext::~PollableExecutionContext() {
+    close(m_epollFd);
+    close(m_timerFd);
+}
+
+void PollableExecutionContext::stop() {
+    m_running = false;
+    wakeUpNow();
+}
+
+void PollableExecutionContext::wakeUpNow() {
+    // only signal on the transition, otherwise the fd is already readable
+    if (!m_hasWork.exchange(true)) {
+        m_wakeUpFd->signal();
+    }
+}
+
+void PollableExecutionContext::armTimerL(std::optional<clock_t::time_point> time) {
+    if (time == m_armedTime) return;
+    m_armedTime = time;
+
+    itimerspec spec = {}; // zero disarms the timer
+    if (time) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time->time_since_epoch()).count();
+        if (ns <= 0) ns = 1; // zero would disarm it
+        spec.it_value.tv_sec = time_t(ns / 1'000'000'000);
+        spec.it_value.tv_nsec = long(ns % 1'000'000'000);
+    }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void PollableExecutionContext::scheduleNextWakeUp(ms_t timeFromNow) {
+    std::lock_guard<std::mutex> lk(m_timerMutex);
+    armTimerL(clock_t::now() + timeFromNow);
+}
+
+void PollableExecutionContext::unscheduleNextWakeUp() {
+    std::lock_guard<std::mutex> lk(m_timerMutex);
+    armTimerL(std::nullopt);
+}
+
+bool PollableExecutionContext::poll() {
+    // drain before consuming the flag
+    // this way a wake up which comes in between will leave the fd readable and we'll be polled again
+    m_wakeUpFd->drain();
+    bool ready = m_hasWork.exchange(false);
+
+    std::lock_guard<std::mutex> lk(m_timerMutex);
+    uint64_t expirations = 0;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) > 0 && expirations) {
+        // timer was consumed
+        m_armedTime.reset();
+        ready = true;
+    }
+    else if (ready && m_armedTime) {
+        // forget about scheduling wakeup if we were woken up with work to do
+        armTimerL(std::nullopt);
+    }
+
+    return ready;
+}
+
+PollableExecution::PollableExecution(ExecutorBase& e)
+    : m_executor(e)
+{
+    auto ctx = std::make_unique<PollableExecutionContext>();
+    m_context = ctx.get();
+    m_executor.setExecutionContext(std::move(ctx));
+}
+
+bool PollableExecution::runReady() {
+    if (m_finalized) return false;
+
+    if (m_context->poll() && m_context->running()) {
+        updateExecutor(m_executor);
+    }
+
+    if (!m_context->running()) {
+        m_executor.finalize();
+        m_finalized = true;
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,79 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ExecutionContext.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <optional>
+
+// linux only
+
+namespace xec {
+
+class EventFd;
+
+// An execution context which can be embedded in a foreign event loop (epoll, libuv, asio...)
+// It exposes a single pollable file descriptor, which becomes readable when the executor needs to be updated
+// Internally it's an epoll fd which combines an eventfd (for wakeUpNow) and a timerfd (for scheduled wake ups)
+// There is no blocking wait. Instead the host loop calls poll() when the fd is readable
+class XEC_API PollableExecutionContext final : public ExecutionContext {
+public:
+    PollableExecutionContext();
+    ~PollableExecutionContext();
+
+    // run status
+    // both funcs are safe to call from any thread
+    virtual bool running() const override { return m_running; }
+    virtual void stop() override;
+
+    // safe to call from any thread
+    void wakeUpNow() override;
+    void scheduleNextWakeUp(ms_t timeFromNow) override;
+    void unscheduleNextWakeUp() override;
+
+    // the file descriptor to add to the host loop (for readability)
+    int fd() const { return m_epollFd; }
+
+    // never blocks
+    // return true if the executor needs to be updated and make the fd non-readable again
+    // call on the execution thread
+    bool poll();
+
+private:
+    std::atomic_bool m_running;
+    std::atomic_bool m_hasWork;
+
+    std::unique_ptr<EventFd> m_wakeUpFd;
+    int m_timerFd;
+    int m_epollFd;
+
+    std::mutex m_timerMutex;
+    std::optional<clock_t::time_point> m_armedTime; // to spare syscalls when the time doesn't change
+    void armTimerL(std::optional<clock_t::time_point> time);
+};
+
+// drive an executor from a foreign event loop with no extra threads
+class XEC_API PollableExecution {
+public:
+    PollableExecution(ExecutorBase& e);
+
+    PollableExecutionContext& context() { return *m_context; }
+    int fd() const { return m_context->fd(); }
+
+    // never blocks
+    // call when the fd is readable (calling it at other times is harmless)
+    // updates the executor if it has work
+    // return false if the execution has been stopped, in which case the executor is finalized
+    // (on the first call to return false) and the fd can be removed from the host loop
+    bool runReady();
+
+protected:
+    ExecutorBase& m_executor;
+    PollableExecutionContext* m_context = nullptr;
+    bool m_finalized = false;
+};
+
+}
@@ -4,40 +4,64 @@
 #include "PoolExecution.hpp"
 #include "ExecutorBase.hpp"
 #include "ExecutionContext.hpp"
+#include "Strand.hpp"
 
 #include "ThreadName.hpp"
 
 #include "bits/TimedQueue.hpp"
-#include "bits/ordered_linear_set.hpp"
+#include "bits/trace.hpp"
+#include "bits/update.hpp"
 
 #include <itlib/qalgorithm.hpp>
 
 #include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
 #include <thread>
 #include <atomic>
 #include <mutex>
 #include <string>
 #include <cassert>
+#include <cstdint>
+#include <utility>
 #include <optional>
-#include <unordered_set>
 #include <condition_variable>
+#include <future>
+#include <new>
 
 namespace xec {
 
+namespace {
+// compact index of a context in the slab of the pool
+using ctx_handle = uint32_t;
+
+// index of a worker in the pool
+using worker_index = uint32_t;
+constexpr worker_index no_worker = worker_index(-1);
+}
+
+// the context is a thin facade owned by the executor
+// the state which the pool needs to dispatch it is in the slab of the pool (see Impl)
 class PoolExecution::Context final : public ExecutionContext {
     PoolExecution::Impl& m_execution;
     ExecutorBase& m_executor;
+    const ctx_handle m_handle;
     std::atomic_bool m_running = true;
 
     // scheduled wake up time
+    // only touched by the worker which updates the executor
     std::optional<clock_t::time_point> m_scheduledWakeUpTime;
 public:
-    Context(PoolExecution::Impl& execution, ExecutorBase& executor)
+    Context(PoolExecution::Impl& execution, ExecutorBase& executor, ctx_handle handle)
         : m_execution(execution)
         , m_executor(executor)
+        , m_handle(handle)
     {}
 
     ExecutorBase& executor() { return m_executor; }
+    ctx_handle handle() const { return m_handle; }
+    bool belongsTo(const PoolExecution::Impl& execution) const { return &m_execution == &execution; }
 
     const std::optional<clock_t::time_point>& scheduledWakeUpTime() const noexcept { return m_scheduledWakeUpTime; }
 
@@ -54,12 +78,31 @@ public:
     virtual void stop() override;
 
     virtual bool running() const override;
+
+    // stop without waking up
+    // return true if the context was running
+    bool markStopped() { return m_running.exchange(false, std::memory_order_release); }
+
+    // set by the worker after it finalizes the executor, so that the context is released from the pool
+    bool m_finalized = false;
 };
 
+namespace {
+// the pool of the current thread, if it's a worker
+thread_local PoolExecution::Impl* t_currentPool = nullptr;
+thread_local bool t_inBlockingRegion = false;
+}
+
 class PoolExecution::Impl {
 public:
+    explicit Impl(std::pmr::memory_resource* resource) : m_resource(resource) {}
+
+    // all containers allocate from this
+    // it's only used under the mutex
+    std::pmr::memory_resource* const m_resource;
+
     // wait state
-    std::condition_variable m_cv;
+    // each worker waits on a condition variable of its own (see WorkerState), so it can be woken up alone
     std::mutex m_mutex;
 
     bool m_running = true; // running flag
@@ -67,115 +110,688 @@ public:
     // scheduled wake up time
     std::optional<clock_t::time_point> m_scheduledWakeUpTime;
 
-    ordered_linear_set<Context*> m_activeContexts; // currently being executed
+    // contexts are stored in a slab of chunks, which are never freed (until the pool is destroyed) nor moved
+    // so handles are stable and the chunks are contiguous and cache line aligned
+    // the hot state is what workers check on every dispatch: it is packed densely in its own array, separate from the
+    // cold one (the facade). All of it is guarded by the mutex, so there is no false sharing to speak of
+    // (the only atomic state - the running flag - is in the facade and written only when stopping)
+    struct HotState {
+        bool used = false;
+        bool pending = false; // waiting to be executed (it's in the pending queue, possibly more than once)
+        bool active = false; // currently being executed
+        bool removing = false; // being removed from the execution
+        bool hasLatencyTarget = false; // the executor has a latency target, so its deadline is tracked in the stats
+        uint32_t scheduleSeq = 0; // entries in m_scheduledContexts with another seq are stale
+        worker_index lastWorker = no_worker; // the worker which last updated the context
+        uint64_t preferredWorkers = 0; // affinity mask
+        clock_t::time_point readyTime; // of the current pending state
+        clock_t::time_point deadline; // of the current pending state
+    };
+    struct ColdState {
+        Context* context = nullptr;
+        ExecutorStats stats;
+    };
 
-    ordered_linear_set<Context*, std::deque> m_pendingContexts; // waiting to be executed
+    static constexpr size_t CacheLineSize = 64;
+    static constexpr ctx_handle ChunkBits = 8;
+    static constexpr ctx_handle ChunkSize = ctx_handle(1) << ChunkBits;
 
-    std::unordered_set<Context*> m_allContexts; // all contexts
+    struct alignas(CacheLineSize) Chunk {
+        HotState hot[ChunkSize];
+        ColdState cold[ChunkSize];
+    };
 
-    struct TimedContext {
-        Context* ctx;
-        clock_t::time_point time;
+    std::pmr::vector<Chunk*> m_chunks{m_resource}; // allocated from the memory resource and freed in the destructor
+    std::pmr::vector<ctx_handle> m_freeHandles{m_resource};
+    size_t m_numContexts = 0;
+
+    HotState& hotL(ctx_handle h) { return m_chunks[h >> ChunkBits]->hot[h & (ChunkSize - 1)]; }
+    ColdState& coldL(ctx_handle h) { return m_chunks[h >> ChunkBits]->cold[h & (ChunkSize - 1)]; }
 
-        struct ByCtx {
-            Context& ctx;
-            bool operator()(const TimedContext& tc) const {
-                return &ctx == tc.ctx;
+    ctx_handle allocHandleL() {
+        ctx_handle h;
+        if (!m_freeHandles.empty()) {
+            h = m_freeHandles.back();
+            m_freeHandles.pop_back();
+        }
+        else {
+            h = ctx_handle(m_chunks.size() * ChunkSize);
+            m_chunks.push_back(new (m_resource->allocate(sizeof(Chunk), alignof(Chunk))) Chunk);
+            // push the rest of the chunk in reverse, so handles are given in order
+            for (auto i = h + ChunkSize - 1; i > h; --i) {
+                m_freeHandles.push_back(i);
             }
-        };
+        }
+
+        auto& hot = hotL(h);
+        assert(!hot.used);
+        auto seq = hot.scheduleSeq;
+        hot = {};
+        hot.used = true;
+        hot.scheduleSeq = seq + 1; // invalidate entries left from the previous owner
+        ++m_numContexts;
+        return h;
+    }
+
+    void freeHandleL(ctx_handle h) {
+        auto& hot = hotL(h);
+        assert(hot.used);
+        hot.used = false;
+        hot.pending = false; // leftovers in the pending queue are skipped
+        ++hot.scheduleSeq; // as are leftovers in the scheduled queue
+        coldL(h) = {};
+        m_freeHandles.push_back(h);
+        --m_numContexts;
+
+        if (!m_running && m_numContexts == 0) {
+            completeStopL();
+        }
+    }
+
+    // stopping
+    // instead of walking all contexts on stop, the workers claim them for finalization in batches by moving a cursor
+    // through the slab, so stopping is O(1) and the finalization is done in parallel with a lock per batch
+    static constexpr ctx_handle FinalizationBatchSize = 32;
+    ctx_handle m_finalizationCursor = 0;
+
+    // completed when all contexts have been finalized after stop
+    std::promise<void> m_stopPromise;
+    std::shared_future<void> m_stopFuture = m_stopPromise.get_future().share();
+    bool m_stopCompleted = false;
+
+    void completeStopL() {
+        if (m_stopCompleted) return;
+        m_stopCompleted = true;
+        m_stopPromise.set_value();
+    }
+
+    // claim the next batch of contexts to finalize
+    // return false if there are none
+    bool claimFinalizationBatchL(std::vector<Context*>& batch) {
+        assert(batch.empty());
+        const auto end = ctx_handle(m_chunks.size() * ChunkSize);
+        while (m_finalizationCursor < end && batch.size() < FinalizationBatchSize) {
+            const auto h = m_finalizationCursor++;
+            auto& hot = hotL(h);
+            if (!hot.used) continue;
+
+            // active contexts are stopped when they're released and removed ones are left to the remover
+            if (hot.active || hot.removing) continue;
+
+            auto ctx = coldL(h).context;
+            ctx->markStopped();
+            hot.pending = false;
+            hot.active = true;
+            batch.push_back(ctx);
+        }
+        return !batch.empty();
+    }
+
+    DispatchPolicy m_dispatchPolicy = DispatchPolicy::Fifo;
+    ms_t m_defaultLatencyTarget = ms_t(100);
+    DeadlineStats m_deadlineStats;
+
+    // waiting to be executed
+    // only one of the queues is used, depending on the dispatch policy
+    // invalidated lazily: entries of contexts which are not pending are skipped
+    std::pmr::deque<ctx_handle> m_pendingQueue{m_resource}; // DispatchPolicy::Fifo
+
+    struct PendingContext {
+        ctx_handle handle;
+        clock_t::time_point time; // deadline
+    };
+    // also skipped are entries whose deadline is not the one of the context (left from a previous pending state)
+    TimedQueue<PendingContext> m_pendingByDeadline{m_resource}; // DispatchPolicy::EarliestDeadline
+
+    // workers are registered when they enter their loop
+    // each has a queue for the contexts which prefer it
+    struct WorkerState {
+        explicit WorkerState(std::pmr::memory_resource* resource) : queue(resource) {}
+        std::pmr::deque<ctx_handle> queue; // invalidated lazily like the shared one
+        std::condition_variable cv;
+        bool idle = false; // waiting for work and not notified yet (it's in m_idleWorkers)
+        bool alive = true;
+        bool compensating = false; // launched for a worker in a blocking region
+        bool retired = false; // a compensating worker which is no longer needed
     };
+    std::pmr::vector<std::unique_ptr<WorkerState>> m_workers{m_resource};
+    std::atomic<worker_index> m_nextWorkerIndex = 0;
+    ms_t m_affinityThreshold = ms_t(1);
 
-    TimedQueue<TimedContext> m_scheduledContexts;
+    // a stack of the idle workers, so the one which was idle for the shortest time (and is likely to have
+    // the warmest cache) is woken up first
+    // workers are notified under the mutex, as they can't be destroyed while it's locked
+    std::pmr::vector<worker_index> m_idleWorkers{m_resource};
 
-    ~Impl() {
-        stopAndJoinThreads();
+    // wake up one idle worker (if there are any) to pick up shared work
+    void notifyIdleWorkerL() {
+        if (m_idleWorkers.empty()) return;
+        auto& ws = *m_workers[m_idleWorkers.back()];
+        m_idleWorkers.pop_back();
+        ws.idle = false;
+        ws.cv.notify_one();
+    }
+
+    // wake up a specific worker
+    // return false if it's not idle (it will check for work before waiting again)
+    bool notifyWorkerL(worker_index w) {
+        auto& ws = *m_workers[w];
+        if (!ws.idle) return false;
+        m_idleWorkers.erase(std::find(m_idleWorkers.begin(), m_idleWorkers.end(), w));
+        ws.idle = false;
+        ws.cv.notify_one();
+        return true;
+    }
+
+    void notifyAllWorkersL() {
+        for (auto w : m_idleWorkers) {
+            auto& ws = *m_workers[w];
+            ws.idle = false;
+            ws.cv.notify_one();
+        }
+        m_idleWorkers.clear();
     }
 
-    void wakeUpNow(Context& ctx) {
+    // blocking regions
+    // workers in blocking regions are compensated by extra workers, so the number of runnable ones stays the same
+    // a compensating worker retires when there are more of them than blocked workers and is parked for reuse
+    size_t m_numBlockedWorkers = 0;
+    size_t m_numCompensatingWorkers = 0; // including the ones which are being unparked or launched
+    size_t m_numParkedWorkers = 0;
+    size_t m_numUnparkRequests = 0;
+    std::condition_variable m_parkedCV;
+    std::vector<std::thread> m_compensatingThreads;
+
+    void enterBlocking() {
         {
             std::lock_guard<std::mutex> lk(m_mutex);
-            if (!m_pendingContexts.insert(&ctx)) {
-                // an opportunity to prevent needless wakeups of workers
-                // if the context is already pending, there's nothing to do and
-                // * either workers are are waiting on a mutex lock to get it
-                // * or they are sleeping because they can't get it, because it's already locked by another worker
-                //   and this worker will get this context in its next iteration
+            ++m_numBlockedWorkers;
+
+            // when stopping the remaining work is just finalization, so there's no point in compensating
+            if (!m_running || m_numCompensatingWorkers >= m_numBlockedWorkers) return;
+            ++m_numCompensatingWorkers;
+
+            if (m_numParkedWorkers) {
+                --m_numParkedWorkers;
+                ++m_numUnparkRequests;
+                m_parkedCV.notify_one();
+                return;
+            }
+        }
+
+        // launch outside of the lock
+        std::thread t([this, w = m_nextWorkerIndex++] { runCompensating(w); });
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_compensatingThreads.push_back(std::move(t));
+    }
+
+    void leaveBlocking() {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        --m_numBlockedWorkers;
+        if (m_numCompensatingWorkers <= m_numBlockedWorkers) return;
+
+        // wake up an idle compensating worker, so it retires
+        // (busy ones will check whether to retire when they're done)
+        for (auto w : m_idleWorkers) {
+            if (m_workers[w]->compensating) {
+                notifyWorkerL(w);
+                break;
+            }
+        }
+    }
+
+    void runCompensating(worker_index worker) {
+        while (true) {
+            run(worker, true);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto& ws = *m_workers[worker];
+            if (!ws.retired) {
+                // the pool was stopped
+                --m_numCompensatingWorkers;
                 return;
             }
 
-            // we added the context to the pending list, so remove it from the scheduled one
-            m_scheduledContexts.eraseFirst(TimedContext::ByCtx{ctx});
+            // retired workers are counted as parked in waitForContext
+            m_parkedCV.wait(lock, [this] { return m_numUnparkRequests || !m_running; });
+            if (!m_numUnparkRequests) {
+                --m_numParkedWorkers;
+                return;
+            }
+            --m_numUnparkRequests; // the parked count was decremented by the request
+            ws.retired = false;
         }
-        m_cv.notify_one();
     }
 
-    Context* waitForContext(Context* contextToFree) {
+    bool isAliveL(worker_index w) const {
+        return w < m_workers.size() && m_workers[w] && m_workers[w]->alive;
+    }
+
+    // return the worker whose queue the context should be in or no_worker for the shared one
+    worker_index preferredWorkerL(const HotState& hot) const {
+        if (!hot.preferredWorkers || !m_running) return no_worker; // when stopping all contexts are shared
+        if (hot.lastWorker < 64 && (hot.preferredWorkers & (uint64_t(1) << hot.lastWorker)) && isAliveL(hot.lastWorker)) {
+            // stick to the last one if it's preferred, so its cache is warm
+            return hot.lastWorker;
+        }
+        for (worker_index w = 0; w < 64; ++w) {
+            if ((hot.preferredWorkers & (uint64_t(1) << w)) && isAliveL(w)) return w;
+        }
+        return no_worker; // none of the preferred workers is running
+    }
+
+    // queue the context and wake up a worker for it
+    void queuePendingL(ctx_handle h) {
+        const auto w = preferredWorkerL(hotL(h));
+        if (w != no_worker) {
+            m_workers[w]->queue.push_back(h);
+            if (!notifyWorkerL(w)) {
+                // the preferred worker is busy
+                // wake up another one, so it can steal the context if it's not picked up in time
+                notifyIdleWorkerL();
+            }
+            return;
+        }
+
+        if (m_dispatchPolicy == DispatchPolicy::Fifo) {
+            m_pendingQueue.push_back(h);
+        }
+        else {
+            m_pendingByDeadline.push({h, hotL(h).deadline});
+        }
+        notifyIdleWorkerL();
+    }
+
+    // the ready time is the time at which the context should be updated
+    // (it's the scheduled time for scheduled wake ups, so the time spent waiting for a worker counts toward the deadline)
+    // return false if the context was already pending
+    bool makePendingL(ctx_handle h, clock_t::time_point readyTime) {
+        auto& hot = hotL(h);
+        if (hot.pending) return false;
+        hot.pending = true;
+        ++hot.scheduleSeq; // pending contexts are not scheduled
+        hot.readyTime = readyTime;
+
+        const auto target = coldL(h).context->executor().latencyTarget();
+        hot.hasLatencyTarget = target > ms_t(0);
+        hot.deadline = readyTime + (hot.hasLatencyTarget ? target : m_defaultLatencyTarget);
+
+        queuePendingL(h);
+        return true;
+    }
+
+    // return true if the context can be dispatched
+    // entries of contexts for which this is false are dropped from the queues
+    bool readyL(const HotState& hot) const {
+        if (!hot.used || !hot.pending) {
+            // stale entry
+            return false;
+        }
+
+        if (hot.removing) {
+            // the context is being removed, leave it to the remover
+            return false;
+        }
+
+        if (hot.active) {
+            // the context is already active (on another thread), so skip it
+            // it will be queued again when it's released
+            return false;
+        }
+
+        return true;
+    }
+
+    Context* dispatchL(ctx_handle h, worker_index worker) {
+        auto& hot = hotL(h);
+        hot.pending = false;
+        hot.active = true;
+
+        auto& cold = coldL(h);
+        if (!m_running) {
+            // not claimed for finalization yet, but there's no point in updating it
+            cold.context->markStopped();
+        }
+        ++cold.stats.numDispatches;
+        if (hot.lastWorker != no_worker && hot.lastWorker != worker) {
+            ++cold.stats.numMigrations;
+        }
+        hot.lastWorker = worker;
+
+        if (hot.hasLatencyTarget) {
+            ++m_deadlineStats.numDispatches;
+            const auto lateness = clock_t::now() - hot.deadline;
+            if (lateness > clock_t::duration::zero()) {
+                ++m_deadlineStats.numMisses;
+                const auto lateUs = std::chrono::duration_cast<std::chrono::microseconds>(lateness);
+                m_deadlineStats.maxLateness = std::max(m_deadlineStats.maxLateness, lateUs);
+            }
+        }
+
+        return cold.context;
+    }
+
+    // return the pending context which should be executed next by a worker (or null if there is none)
+    Context* popPendingL(worker_index worker) {
+        // first the contexts which prefer this worker
+        if (worker < m_workers.size()) {
+            auto& queue = m_workers[worker]->queue;
+            while (!queue.empty()) {
+                const auto h = queue.front();
+                queue.pop_front();
+                if (readyL(hotL(h))) return dispatchL(h, worker);
+            }
+        }
+
+        // then the shared ones
+        while (true) {
+            ctx_handle h;
+            if (m_dispatchPolicy == DispatchPolicy::Fifo) {
+                if (m_pendingQueue.empty()) break;
+                h = m_pendingQueue.front();
+                m_pendingQueue.pop_front();
+            }
+            else {
+                if (m_pendingByDeadline.empty()) break;
+                auto top = m_pendingByDeadline.topAndPop();
+                h = top.handle;
+                if (top.time != hotL(h).deadline) {
+                    // stale entry
+                    continue;
+                }
+            }
+
+            if (readyL(hotL(h))) return dispatchL(h, worker);
+        }
+
+        // finally steal a context from a worker which hasn't gotten to it in time
+        std::optional<clock_t::time_point> now;
+        for (worker_index w = 0; w < m_workers.size(); ++w) {
+            if (w == worker || !m_workers[w]) continue;
+            auto& queue = m_workers[w]->queue;
+            while (!queue.empty()) {
+                const auto h = queue.front();
+                auto& hot = hotL(h);
+                if (!readyL(hot)) {
+                    queue.pop_front();
+                    continue;
+                }
+                if (!now) now = clock_t::now();
+                if (hot.readyTime + m_affinityThreshold <= *now) {
+                    queue.pop_front();
+                    return dispatchL(h, worker);
+                }
+                break; // the front is the oldest one
+            }
+        }
+
+        return nullptr;
+    }
+
+    // return the earliest time at which a worker can steal a context from another
+    std::optional<clock_t::time_point> nextStealTimeL(worker_index worker) {
+        std::optional<clock_t::time_point> ret;
+        for (worker_index w = 0; w < m_workers.size(); ++w) {
+            if (w == worker || !m_workers[w]) continue;
+            auto& queue = m_workers[w]->queue;
+            if (queue.empty()) continue; // stale entries are popped in popPendingL, so the front is ready
+            const auto t = hotL(queue.front()).readyTime + m_affinityThreshold;
+            if (!ret || t < *ret) ret = t;
+        }
+        return ret;
+    }
+
+    void setDispatchPolicy(DispatchPolicy policy, ms_t defaultLatencyTarget) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_defaultLatencyTarget = defaultLatencyTarget;
+        if (policy == m_dispatchPolicy) return;
+        m_dispatchPolicy = policy;
+
+        // move the pending contexts to the queue of the new policy
+        m_pendingQueue.clear();
+        m_pendingByDeadline.clear();
+        for (auto& w : m_workers) {
+            if (w) w->queue.clear();
+        }
+        for (ctx_handle h = 0; h < m_chunks.size() * ChunkSize; ++h) {
+            auto& hot = hotL(h);
+            if (hot.used && hot.pending) {
+                queuePendingL(h);
+            }
+        }
+        notifyAllWorkersL();
+    }
+
+    struct TimedContext {
+        ctx_handle handle;
+        uint32_t seq;
+        clock_t::time_point time;
+    };
+
+    // invalidated lazily: entries whose seq doesn't match the one of the context are skipped
+    TimedQueue<TimedContext> m_scheduledContexts{m_resource};
+
+    ms_t m_timerSlack = ms_t(0);
+    TimerStats m_timerStats;
+
+    bool validL(const TimedContext& tc) {
+        auto& hot = hotL(tc.handle);
+        return hot.used && hot.scheduleSeq == tc.seq;
+    }
+
+    void scheduleL(ctx_handle h, clock_t::time_point time) {
+        auto& hot = hotL(h);
+        m_scheduledContexts.push({h, ++hot.scheduleSeq, applyTimerSlack(time, m_timerSlack)});
+
+        // contexts which are woken up before their scheduled time leave stale entries
+        // don't let them pile up
+        if (m_scheduledContexts.size() > 2 * m_numContexts + 64) {
+            m_scheduledContexts.eraseAll([this](const TimedContext& tc) { return !validL(tc); });
+        }
+    }
+
+    // notified when a context which is being removed is released by a worker
+    std::condition_variable m_removeCV;
+
+    // strands waiting to be executed
+    // an intrusive list through Strand::m_nextScheduled, so scheduling a strand never allocates
+    Strand* m_pendingStrandsHead = nullptr;
+    Strand* m_pendingStrandsTail = nullptr;
+
+    // alternate between contexts and strands so neither can starve the other
+    bool m_strandsTurn = false;
+
+    Strand* popPendingStrandL() {
+        auto strand = m_pendingStrandsHead;
+        if (!strand) return nullptr;
+        m_pendingStrandsHead = strand->m_nextScheduled;
+        if (!m_pendingStrandsHead) m_pendingStrandsTail = nullptr;
+        strand->m_nextScheduled = nullptr;
+        return strand;
+    }
+
+    ~Impl() {
+        stopAndJoinThreads();
+
+        for (auto chunk : m_chunks) {
+            chunk->~Chunk();
+            m_resource->deallocate(chunk, sizeof(Chunk), alignof(Chunk));
+        }
+    }
+
+    void wakeUpNow(ctx_handle h) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!hotL(h).used) return; // released in the meantime
+
+        // if the context is already pending, this doesn't wake up a worker, as there's nothing to do and
+        // * either workers are are waiting on a mutex lock to get it
+        // * or they are sleeping because they can't get it, because it's already locked by another worker
+        //   and this worker will get this context in its next iteration
+        makePendingL(h, clock_t::now());
+    }
+
+    void scheduleStrand(Strand& strand) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        assert(!strand.m_nextScheduled);
+        if (m_pendingStrandsTail) {
+            m_pendingStrandsTail->m_nextScheduled = &strand;
+        }
+        else {
+            m_pendingStrandsHead = &strand;
+        }
+        m_pendingStrandsTail = &strand;
+        notifyIdleWorkerL();
+    }
+
+    // return a context to execute or null if there is no more work and the pool has been stopped
+    // if a strand should be executed instead, the returned context is null and the strand is set in the out argument
+    // if contexts should be finalized, the returned context is null and they're set in the batch
+    Context* waitForContext(Context* contextToFree, std::vector<Context*>& batch, Strand*& strand, worker_index worker) {
         std::unique_lock<std::mutex> lock(m_mutex);
 
+        for (auto ctx : batch) {
+            // the caller thread has finalized a batch of contexts
+            auto& hot = hotL(ctx->handle());
+            hot.active = false;
+            if (hot.removing) {
+                m_removeCV.notify_all();
+            }
+            freeHandleL(ctx->handle());
+        }
+        batch.clear();
+
         if (contextToFree) {
             // the caller thread has released a context
-            m_activeContexts.erase(contextToFree);
+            const auto h = contextToFree->handle();
+            auto& hot = hotL(h);
+            hot.active = false;
+
+            if (hot.removing) {
+                m_removeCV.notify_all();
+            }
 
-            auto& wakeupTime = contextToFree->scheduledWakeUpTime();
-            if (wakeupTime) {
-                if (m_pendingContexts.find(contextToFree) == m_pendingContexts.end()) {
-                    // context is not pending wakeup, so we add it
-                    m_scheduledContexts.push({ contextToFree, *wakeupTime });
+            if (contextToFree->m_finalized) {
+                freeHandleL(h);
+            }
+            else if (!m_running) {
+                // the pool was stopped while the context was active, so it was skipped when claiming for finalization
+                // if it's being removed, the remover finalizes it
+                if (!hot.removing) {
+                    contextToFree->markStopped();
+                    if (hot.pending) {
+                        queuePendingL(h);
+                    }
+                    else {
+                        makePendingL(h, clock_t::now());
+                    }
                 }
-                // else this context is pending wakup anyway, so there's nothing to do
+            }
+            else if (hot.pending) {
+                // woken up while active, its entry in the pending queue may have been skipped
+                queuePendingL(h);
+            }
+            else if (auto& wakeupTime = contextToFree->scheduledWakeUpTime()) {
+                scheduleL(h, *wakeupTime);
             }
             else {
                 // this context doesn't have a scheduled wake up time
-                // so we should remove it from the scheduled contexts (if it's there)
-                m_scheduledContexts.eraseFirst(TimedContext::ByCtx{ *contextToFree });
+                // so invalidate its entry in the scheduled contexts (if it's there)
+                ++hot.scheduleSeq;
             }
         }
 
         while (true) {
+            if (auto& ws = *m_workers[worker]; ws.compensating && m_numCompensatingWorkers > m_numBlockedWorkers) {
+                // a blocked worker has returned, so we're not needed anymore
+                // count as parked right away, so a new blocking region can reuse us instead of launching a thread
+                --m_numCompensatingWorkers;
+                ++m_numParkedWorkers;
+                ws.retired = true;
+                return nullptr;
+            }
+
             if (!m_scheduledContexts.empty()) {
                 // first, if we have scheduled contexts which are ready, move them to pending
                 // and update the scheduled wake up time appropriately
 
                 const auto now = clock_t::now();
+                uint64_t numDue = 0;
                 while (true) {
                     auto& top = m_scheduledContexts.top();
 
-                    if (top.time <= now) {
-                        m_pendingContexts.insert(top.ctx);
+                    if (!validL(top)) {
                         m_scheduledContexts.pop();
-                        if (m_scheduledContexts.empty()) {
-                            m_scheduledWakeUpTime.reset();
-                            break;
-                        }
+                    }
+                    else if (top.time <= now) {
+                        makePendingL(top.handle, top.time);
+                        m_scheduledContexts.pop();
+                        ++numDue;
                     }
                     else {
                         m_scheduledWakeUpTime = top.time;
                         break;
                     }
+
+                    if (m_scheduledContexts.empty()) {
+                        m_scheduledWakeUpTime.reset();
+                        break;
+                    }
+                }
+
+                if (numDue) {
+                    ++m_timerStats.numTimerFires;
+                    m_timerStats.numTimedWakeUps += numDue;
                 }
             }
 
-            for (auto i = m_pendingContexts.begin(); i != m_pendingContexts.end(); ++i) {
-                auto ctx = *i;
-                if (!m_activeContexts.insert(ctx)) {
-                    // the context is already active (on another thread), so skip it
-                    continue;
+            m_strandsTurn = !m_strandsTurn;
+            if (m_strandsTurn) {
+                strand = popPendingStrandL();
+                if (strand) {
+                    XEC_TRACE(DispatchStrand, strand, 0, 0);
+                    return nullptr;
                 }
+            }
+
+            if (!m_running && claimFinalizationBatchL(batch)) {
+                return nullptr;
+            }
 
-                m_pendingContexts.erase(i);
+            if (auto ctx = popPendingL(worker)) {
+                // this wake up consumes the scheduled one (if any)
+                // the executor will schedule another one in its update if it needs to
+                ctx->unscheduleNextWakeUp();
+
+                XEC_TRACE(DispatchContext, &ctx->executor(), 0, 0);
                 return ctx;
             }
 
+            strand = popPendingStrandL();
+            if (strand) {
+                XEC_TRACE(DispatchStrand, strand, 0, 0);
+                return nullptr;
+            }
+
             if (!m_running) {
-                // we have stopped running and there are no more pending contexts
+                // we have stopped running and there are no more pending contexts or strands
                 // this means they are all stopped and finalized and it's safe to tell the threads to stop
                 // scheduled updates are just skipped (we assume they are not relevant enough)
                 return nullptr;
             }
 
-            if (m_scheduledWakeUpTime) {
+            auto waitUntil = m_scheduledWakeUpTime;
+            if (auto stealTime = nextStealTimeL(worker)) {
+                // contexts which prefer other (busy) workers can be taken by us at this time
+                if (!waitUntil || *stealTime < *waitUntil) waitUntil = stealTime;
+            }
+
+            auto& ws = *m_workers[worker];
+            ws.idle = true;
+            m_idleWorkers.push_back(worker);
+
+            if (waitUntil) {
                 // wait until if we have a wake up time, wait for it
-                auto status = m_cv.wait_until(lock, *m_scheduledWakeUpTime);
+                auto status = ws.cv.wait_until(lock, *waitUntil);
 
                 if (status == std::cv_status::timeout) {
                     m_scheduledWakeUpTime.reset(); // timer was consumed
@@ -195,58 +811,179 @@ public:
                 // when we wake up we either have work and will return
                 // or will have a scheduled wake up time and will wait for it
                 // or it's a spurious wake up and will end up here again
-                m_cv.wait(lock);
+                ws.cv.wait(lock);
+            }
+
+            if (ws.idle) {
+                // not notified (a timeout or a spurious wake up)
+                ws.idle = false;
+                m_idleWorkers.erase(std::find(m_idleWorkers.begin(), m_idleWorkers.end(), worker));
             }
         }
 
         return nullptr;
     }
 
-    void run() {
+    // worker counters for monitoring
+    // they're only informative, so they are relaxed and not guarded by the mutex
+    std::atomic_size_t m_numWorkers = 0;
+    std::atomic_size_t m_numBusyWorkers = 0;
+
+    void run(worker_index worker, bool compensating = false) {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if (worker >= m_workers.size()) m_workers.resize(worker + 1);
+            auto& ws = m_workers[worker];
+            if (!ws) {
+                ws = std::make_unique<WorkerState>(m_resource);
+            }
+            ws->alive = true; // a parked compensating worker may be coming back
+            ws->compensating = compensating;
+        }
+
+        auto prevPool = std::exchange(t_currentPool, this);
+
+        m_numWorkers.fetch_add(1, std::memory_order_relaxed);
         Context* ctx = nullptr;
+        Strand* strand = nullptr;
+        std::vector<Context*> batch;
         while (true) {
-            ctx = waitForContext(ctx);
+            ctx = waitForContext(ctx, batch, strand, worker);
+
+            if (!batch.empty()) {
+                m_numBusyWorkers.fetch_add(1, std::memory_order_relaxed);
+                for (auto bctx : batch) {
+                    finalizeContext(*bctx);
+                }
+                m_numBusyWorkers.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
 
-            if (!ctx) return;
+            if (strand) {
+                m_numBusyWorkers.fetch_add(1, std::memory_order_relaxed);
+                strand->run();
+                m_numBusyWorkers.fetch_sub(1, std::memory_order_relaxed);
+                strand = nullptr;
+                continue;
+            }
+
+            if (!ctx) break;
+
+            m_numBusyWorkers.fetch_add(1, std::memory_order_relaxed);
 
             if (ctx->running()) {
-                ctx->executor().update();
+                updateExecutor(ctx->executor());
             }
             else {
-                {
-                    std::lock_guard<std::mutex> lk(m_mutex);
-                    m_allContexts.erase(ctx);
-                }
-                ctx->executor().finalize();
-
-                // finalize might have inadvertently scheduled wake ups
-                // clear them as we stop this context
-                ctx->unscheduleNextWakeUp();
+                finalizeContext(*ctx);
             }
+            m_numBusyWorkers.fetch_sub(1, std::memory_order_relaxed);
         }
+        m_numWorkers.fetch_sub(1, std::memory_order_relaxed);
+        t_currentPool = prevPool;
+
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_workers[worker]->alive = false;
+    }
+
+    void finalizeContext(Context& ctx) {
+        ctx.executor().finalize();
+
+        // finalize might have inadvertently scheduled wake ups
+        // clear them as we stop this context
+        ctx.unscheduleNextWakeUp();
+
+        // the context will be released from the pool when it's freed
+        ctx.m_finalized = true;
     }
 
-    void stop() {
+    std::shared_future<void> stop() {
         {
             std::lock_guard<std::mutex> lk(m_mutex);
-            if (!m_running) return; // already stopped
+            if (!m_running) return m_stopFuture; // already stopped
             m_running = false;
-            for (auto ctx : m_allContexts) {
-                ctx->stop();
+
+            // the workers will claim the contexts for finalization
+            m_finalizationCursor = 0;
+            if (m_numContexts == 0) {
+                completeStopL();
+            }
+            notifyAllWorkersL();
+        }
+        m_parkedCV.notify_all();
+        return m_stopFuture;
+    }
+
+    bool removeExecutor(ExecutorBase& executor) {
+        auto ctx = dynamic_cast<Context*>(const_cast<ExecutionContext*>(&executor.executionContext()));
+        if (!ctx || !ctx->belongsTo(*this)) return false;
+
+        std::unique_ptr<ExecutionContext> detached; // destroy outside of the lock
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            // stopped contexts are finalized by the workers
+            // the same goes for all contexts once the pool is stopped, as they may already be claimed for finalization
+            if (!m_running || !ctx->running()) return false;
+
+            const auto h = ctx->handle();
+            if (hotL(h).removing) return false; // being removed by another thread
+
+            // prevent workers from picking it up and wait for it to be released if it's currently executing
+            hotL(h).removing = true;
+            m_removeCV.wait(lock, [&] { return !hotL(h).active; });
+
+            if (!m_running) {
+                // the pool was stopped while we were waiting and the context was skipped when claiming for finalization
+                // the workers may have exited already, so finalize it here, as they would
+                ctx->markStopped();
+                hotL(h).active = true;
+                hotL(h).removing = false;
+                lock.unlock();
+                finalizeContext(*ctx);
+                lock.lock();
+                hotL(h).active = false;
+                freeHandleL(h);
+                return false;
+            }
+            hotL(h).removing = false;
+
+            const bool pending = hotL(h).pending;
+            const auto wakeUpTime = ctx->scheduledWakeUpTime();
+            freeHandleL(h);
+
+            detached = executor.detachExecutionContext();
+
+            // transfer the pending state to the executor's initial context
+            // from there it will be transferred to the next one
+            if (pending) {
+                executor.wakeUpNow();
+            }
+            else if (wakeUpTime) {
+                // round up, so the wake up doesn't happen before the originally scheduled time
+                auto diff = *wakeUpTime - clock_t::now();
+                executor.scheduleNextWakeUp(std::chrono::ceil<ms_t>(std::max(diff, clock_t::duration::zero())));
             }
         }
-        m_cv.notify_all();
+        return true;
     }
 
-    void addExecutor(ExecutorBase& executor) {
-        auto ctx = std::make_unique<Context>(*this, executor);
+    void addExecutor(ExecutorBase& executor, uint64_t preferredWorkers) {
+        std::unique_ptr<Context> ctx;
         {
             std::lock_guard<std::mutex> lk(m_mutex);
-            m_pendingContexts.insert(ctx.get());
-            m_allContexts.insert(ctx.get());
-            executor.setExecutionContext(std::move(ctx));
+            const auto h = allocHandleL();
+            ctx = std::make_unique<Context>(*this, executor, h);
+            coldL(h).context = ctx.get();
+            hotL(h).preferredWorkers = preferredWorkers;
         }
-        m_cv.notify_one();
+        auto pctx = ctx.get();
+
+        // this must happen outside of the lock, as it will transfer the wake ups of the initial context to ours
+        // wake ups will make the context pending, which is what we do below anyway
+        executor.setExecutionContext(std::move(ctx));
+
+        std::lock_guard<std::mutex> lk(m_mutex);
+        makePendingL(pctx->handle(), clock_t::now());
     }
 
     std::vector<std::thread> m_threads;
@@ -256,23 +993,23 @@ public:
 
         if (threadName) {
             if (count == 1) {
-                m_threads.emplace_back([this, name = std::string(*threadName)] {
+                m_threads.emplace_back([this, name = std::string(*threadName), w = m_nextWorkerIndex++] {
                     SetThisThreadName(name);
-                    run();
+                    run(w);
                 });
             }
             else {
                 for (size_t i = 0; i < count; ++i) {
-                    m_threads.emplace_back([this, name = std::string(*threadName) + std::to_string(i + 1)] {
+                    m_threads.emplace_back([this, name = std::string(*threadName) + std::to_string(i + 1), w = m_nextWorkerIndex++] {
                         SetThisThreadName(name);
-                        run();
+                        run(w);
                     });
                 }
             }
         }
         else {
             for (size_t i = 0; i < count; ++i) {
-                m_threads.emplace_back([this] { run(); });
+                m_threads.emplace_back([this, w = m_nextWorkerIndex++] { run(w); });
             }
         }
     }
@@ -281,11 +1018,31 @@ public:
         for (auto& t : m_threads) {
             t.join();
         }
+        m_threads.clear(); // so we can safely join again (say in the destructor)
+
+        // compensating workers can launch others, so join until there are none
+        while (true) {
+            std::vector<std::thread> compensating;
+            {
+                std::lock_guard<std::mutex> lk(m_mutex);
+                compensating.swap(m_compensatingThreads);
+            }
+            if (compensating.empty()) break;
+            for (auto& t : compensating) {
+                t.join();
+            }
+        }
 
-        // all contexts should be stopped when the threads are joined
-        assert(m_allContexts.empty());
-        assert(m_activeContexts.empty());
-        assert(m_pendingContexts.empty());
+        // all contexts should be stopped and released when the threads are joined
+        assert(m_numContexts == 0);
+
+        // if there are no other workers (calling run), we can start counting them from zero again
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (std::none_of(m_workers.begin(), m_workers.end(), [](auto& w) { return w && w->alive; })) {
+            assert(m_idleWorkers.empty());
+            m_workers.clear();
+            m_nextWorkerIndex = 0;
+        }
     }
 
     void stopAndJoinThreads() {
@@ -296,14 +1053,14 @@ public:
 
 void PoolExecution::Context::wakeUpNow() {
     if (running()) {
-        m_execution.wakeUpNow(*this);
+        m_execution.wakeUpNow(m_handle);
     }
 }
 
 void PoolExecution::Context::stop() {
     if (m_running.exchange(false, std::memory_order_release)) {
         // one final wake up se we can finalize the executor
-        m_execution.wakeUpNow(*this);
+        m_execution.wakeUpNow(m_handle);
     }
 }
 
@@ -311,19 +1068,30 @@ bool PoolExecution::Context::running() const {
     return m_running.load(std::memory_order_acquire);
 }
 
-PoolExecution::PoolExecution()
-    : m_impl(new Impl)
+PoolExecution::PoolExecution(std::pmr::memory_resource* resource)
+    : m_impl(new Impl(resource))
 {}
 PoolExecution::~PoolExecution() = default;
-void PoolExecution::addExecutor(ExecutorBase& executor) {
-    m_impl->addExecutor(executor);
+void PoolExecution::addExecutor(ExecutorBase& executor, uint64_t preferredWorkers) {
+    m_impl->addExecutor(executor, preferredWorkers);
 }
 void PoolExecution::run() {
-    m_impl->run();
+    m_impl->run(m_impl->m_nextWorkerIndex++);
 }
 void PoolExecution::stop() {
     m_impl->stop();
 }
+std::shared_future<void> PoolExecution::stopAsync() {
+    return m_impl->stop();
+}
+bool PoolExecution::removeExecutor(ExecutorBase& executor) {
+    return m_impl->removeExecutor(executor);
+}
+bool PoolExecution::migrateExecutor(ExecutorBase& executor, PoolExecution& target) {
+    if (!removeExecutor(executor)) return false;
+    target.addExecutor(executor);
+    return true;
+}
 void PoolExecution::launchThreads(size_t count, std::optional<std::string_view> threadName) {
     m_impl->launchThreads(count, threadName);
 }
@@ -333,5 +1101,55 @@ void PoolExecution::joinThreads() {
 void PoolExecution::stopAndJoinThreads() {
     m_impl->stopAndJoinThreads();
 }
+void PoolExecution::setDispatchPolicy(DispatchPolicy policy, std::chrono::milliseconds defaultLatencyTarget) {
+    m_impl->setDispatchPolicy(policy, defaultLatencyTarget);
+}
+PoolExecution::DeadlineStats PoolExecution::deadlineStats() const {
+    std::lock_guard<std::mutex> lk(m_impl->m_mutex);
+    return m_impl->m_deadlineStats;
+}
+void PoolExecution::setAffinityThreshold(std::chrono::milliseconds threshold) {
+    std::lock_guard<std::mutex> lk(m_impl->m_mutex);
+    m_impl->m_affinityThreshold = threshold;
+}
+std::optional<PoolExecution::ExecutorStats> PoolExecution::executorStats(const ExecutorBase& executor) const {
+    auto ctx = dynamic_cast<const Context*>(&executor.executionContext());
+    if (!ctx || !ctx->belongsTo(*m_impl)) return {};
+    std::lock_guard<std::mutex> lk(m_impl->m_mutex);
+    auto& cold = m_impl->coldL(ctx->handle());
+    if (cold.context != ctx) return {}; // released
+    return cold.stats;
+}
+void PoolExecution::setTimerSlack(std::chrono::milliseconds slack) {
+    std::lock_guard<std::mutex> lk(m_impl->m_mutex);
+    m_impl->m_timerSlack = slack;
+}
+PoolExecution::TimerStats PoolExecution::timerStats() const {
+    std::lock_guard<std::mutex> lk(m_impl->m_mutex);
+    return m_impl->m_timerStats;
+}
+size_t PoolExecution::numWorkers() const {
+    return m_impl->m_numWorkers.load(std::memory_order_relaxed);
+}
+size_t PoolExecution::numBusyWorkers() const {
+    return m_impl->m_numBusyWorkers.load(std::memory_order_relaxed);
+}
+void PoolExecution::scheduleStrand(Strand& strand) {
+    m_impl->scheduleStrand(strand);
+}
+
+BlockingRegion::BlockingRegion()
+    : m_pool(t_inBlockingRegion ? nullptr : t_currentPool) // only the outermost region counts
+{
+    if (!m_pool) return;
+    t_inBlockingRegion = true;
+    m_pool->enterBlocking();
+}
+
+BlockingRegion::~BlockingRegion() {
+    if (!m_pool) return;
+    m_pool->leaveBlocking();
+    t_inBlockingRegion = false;
+}
 
 }
@@ -4,21 +4,57 @@
 #pragma once
 #include "API.h"
 #include <memory>
+#include <chrono>
 #include <cstdint>
 #include <optional>
 #include <string_view>
+#include <future>
+#include <memory_resource>
+#include <utility>
 
 namespace xec {
 class ExecutorBase;
+class Strand;
 
 class XEC_API PoolExecution {
 public:
-    PoolExecution();
+    // the internal containers (the slab of executor states and the queues) allocate from the given memory resource
+    // it's only used under the lock of the pool (or on destruction), so it doesn't need to be thread safe
+    // NOTE: the execution contexts which the pool gives to executors are owned by them, so they are allocated with
+    //       the global allocator
+    // WARNING: the resource must outlive the pool
+    explicit PoolExecution(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     ~PoolExecution();
 
-    void addExecutor(ExecutorBase& executor); // valid on any thread
+    // the executor can prefer some workers of the pool (bit i of the mask is for the worker with index i)
+    // the affinity is soft: the executor is updated by one of its preferred workers (by the last one, if possible),
+    // unless they are all busy for longer than the affinity threshold, in which case any worker can update it
+    // 0 means no preference
+    // workers are indexed in the order in which they're launched, starting from 0 (threads calling run get the next indices)
+    // valid on any thread
+    void addExecutor(ExecutorBase& executor, uint64_t preferredWorkers = 0);
+    // stopping doesn't block: the executors are finalized by the workers (in parallel) after it
     void stop(); // valid on any thread
 
+    // same as stop, but return a future which becomes ready when all executors have been finalized
+    // (the threads may still be running until joined)
+    // WARNING: the future won't become ready if there are no workers to finalize the executors
+    std::shared_future<void> stopAsync(); // valid on any thread
+
+    // remove an executor from the pool without stopping or finalizing it
+    // if the executor is currently being updated, this will block until the update is done
+    // pending wake ups (including the scheduled wake up time) are kept in the executor,
+    // so it can be given to another execution (with addExecutor or by creating a ThreadExecution for it)
+    // return false if the executor is not in this pool or has been stopped
+    // (including when the pool is stopped while waiting for the update, in which case this finalizes the executor)
+    // valid on any thread but the ones of this pool
+    // WARNING: no other thread must use the executor (for example push tasks to it) during the removal
+    bool removeExecutor(ExecutorBase& executor);
+
+    // remove the executor from this pool and add it to the target one
+    // same conditions as removeExecutor apply
+    bool migrateExecutor(ExecutorBase& executor, PoolExecution& target);
+
     // these three functions must be called on the same thread
     void launchThreads(size_t count, std::optional<std::string_view> threadName = {});
     void joinThreads();
@@ -26,11 +62,99 @@ public:
 
     void run(); // blocks current thread with a worker loop
 
+    // the time a context which prefers some workers can wait for them, before it can be taken by any worker
+    // (1 ms by default)
+    // valid on any thread
+    void setAffinityThreshold(std::chrono::milliseconds threshold);
+
+    struct ExecutorStats {
+        uint64_t numDispatches = 0; // updates (and the finalization)
+        uint64_t numMigrations = 0; // dispatches on a different worker than the previous one
+    };
+    // return empty if the executor is not in this pool
+    // valid on any thread
+    std::optional<ExecutorStats> executorStats(const ExecutorBase& executor) const;
+
+    // dispatch policy
+    // determines which executor a worker picks when more than one are waiting to be updated
+    enum class DispatchPolicy {
+        Fifo, // in the order in which they were woken up (the default)
+
+        // the one with the earliest deadline
+        // the deadline is the time of the wake up plus the latency target of the executor (see ExecutorBase)
+        // for scheduled wake ups, the time of the wake up is the scheduled time (not the time the timer was checked)
+        // executors without a latency target use the default target given here, so they are not starved
+        EarliestDeadline,
+    };
+    // valid on any thread
+    // NOTE: when the policy changes, executors which are already waiting lose their relative order
+    // NOTE: executors with preferred workers are queued per worker in FIFO order, regardless of the policy
+    void setDispatchPolicy(DispatchPolicy policy, std::chrono::milliseconds defaultLatencyTarget = std::chrono::milliseconds(100));
+
+    // statistics of the executors with latency targets
+    // they are collected with any dispatch policy, so the policies can be compared
+    struct DeadlineStats {
+        uint64_t numDispatches = 0; // updates of executors with latency targets
+        uint64_t numMisses = 0; // updates which started after the deadline
+        std::chrono::microseconds maxLateness{}; // of the worst miss
+    };
+    DeadlineStats deadlineStats() const; // valid on any thread
+
+    // timer slack
+    // scheduled wake ups of executors are delayed to the next multiple of the slack,
+    // so executors which are due within the same window of the slack are woken up together with a single timer
+    // a slack of 0 (the default) means precise wake ups
+    // valid on any thread (affects wake ups scheduled after the call)
+    void setTimerSlack(std::chrono::milliseconds slack);
+
+    // statistics of the scheduled wake ups
+    // the number of timed wake ups per timer fire shows how many wake ups were saved by coalescing
+    struct TimerStats {
+        uint64_t numTimerFires = 0; // checks of the scheduled executors in which some were due
+        uint64_t numTimedWakeUps = 0; // executors which were woken up because of their scheduled time
+    };
+    TimerStats timerStats() const; // valid on any thread
+
+    // monitoring
+    // valid on any thread, but only informative as they may change right away
+    size_t numWorkers() const; // threads in the worker loop (launched or calling run)
+    size_t numBusyWorkers() const; // workers which are currently updating an executor or running a strand
+    // NOTE: workers which compensate for ones in blocking regions (see BlockingRegion) are counted as well
+
 public:
     class Impl;
     std::unique_ptr<Impl> m_impl;
 
     class Context;
+
+private:
+    friend class Strand;
+    void scheduleStrand(Strand& strand); // valid on any thread
 };
 
+// Marks the current thread as blocked (on io, a lock, etc) for the lifetime of the object
+// If the thread is a worker of a pool, the pool compensates for it with another worker (a parked one or a new thread),
+// so the number of runnable workers stays the same. When the region ends, the compensating worker retires and is
+// parked for reuse until the pool is stopped
+// Compensating workers get the next worker indices (like threads calling run), so masks of preferred workers should
+// only refer to the launched ones
+// On other threads, in nested regions, and in pools which have been stopped it does nothing
+class XEC_API BlockingRegion {
+public:
+    BlockingRegion();
+    ~BlockingRegion();
+
+    BlockingRegion(const BlockingRegion&) = delete;
+    BlockingRegion& operator=(const BlockingRegion&) = delete;
+private:
+    PoolExecution::Impl* m_pool;
+};
+
+// run f in a blocking region and return its result
+template <typename F>
+decltype(auto) blocking(F&& f) {
+    BlockingRegion region;
+    return std::forward<F>(f)();
+}
+
 }
@@ -0,0 +1,108 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "SimulatedExecution.hpp"
+
+#include "ExecutorBase.hpp"
+
+#include "bits/update.hpp"
+
+namespace xec {
+
+SimulatedExecutionContext::SimulatedExecutionContext(clock_t::time_point start)
+    : m_running(true)
+    , m_now(start)
+    , m_hasWork(true)
+{}
+
+void SimulatedExecutionContext::stop() {
+    m_running = false;
+    wakeUpNow();
+}
+
+void SimulatedExecutionContext::wakeUpNow() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_hasWork = true;
+}
+
+void SimulatedExecutionContext::scheduleNextWakeUp(ms_t timeFromNow) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_scheduledWakeUpTime = m_now + timeFromNow;
+}
+
+void SimulatedExecutionContext::unscheduleNextWakeUp() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_scheduledWakeUpTime.reset();
+}
+
+clock_t::time_point SimulatedExecutionContext::now() const {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_now;
+}
+
+bool SimulatedExecutionContext::next(std::optional<clock_t::time_point> limit) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    if (m_hasWork) {
+        m_hasWork = false;
+        m_scheduledWakeUpTime.reset(); // forget about scheduling wakeup if we were woken up with work to do
+        return true;
+    }
+
+    if (m_scheduledWakeUpTime && (!limit || *m_scheduledWakeUpTime <= *limit)) {
+        // no need to wait: jump to the wake up time
+        if (*m_scheduledWakeUpTime > m_now) {
+            m_now = *m_scheduledWakeUpTime;
+        }
+        m_scheduledWakeUpTime.reset(); // timer was consumed
+        return true;
+    }
+
+    return false;
+}
+
+void SimulatedExecutionContext::advanceTo(clock_t::time_point time) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (time <= m_now) return;
+    m_now = time;
+    if (m_scheduledWakeUpTime && *m_scheduledWakeUpTime <= m_now) {
+        m_hasWork = true;
+        m_scheduledWakeUpTime.reset();
+    }
+}
+
+SimulatedExecution::SimulatedExecution(ExecutorBase& e, clock_t::time_point start)
+    : m_executor(e)
+{
+    auto ctx = std::make_unique<SimulatedExecutionContext>(start);
+    m_context = ctx.get();
+    m_executor.setExecutionContext(std::move(ctx));
+}
+
+size_t SimulatedExecution::run(std::optional<clock_t::time_point> limit) {
+    size_t numUpdates = 0;
+    while (m_context->running()) {
+        if (!m_context->next(limit)) break;
+        updateExecutor(m_executor);
+        ++numUpdates;
+    }
+
+    if (!m_context->running() && !m_finalized) {
+        m_executor.finalize();
+        m_finalized = true;
+    }
+
+    return numUpdates;
+}
+
+size_t SimulatedExecution::runUntilIdle() {
+    return run(std::nullopt);
+}
+
+size_t SimulatedExecution::runUntil(clock_t::time_point time) {
+    auto ret = run(time);
+    m_context->advanceTo(time);
+    return ret;
+}
+
+}
@@ -0,0 +1,85 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ExecutionContext.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <optional>
+
+namespace xec {
+
+// An execution context with a virtual clock
+// Instead of waiting for scheduled wake ups, time jumps to them instantly
+// This allows hours of schedules to be replayed in milliseconds and deterministically
+class XEC_API SimulatedExecutionContext final : public ExecutionContext {
+public:
+    // the virtual time starts at the given point
+    // it defaults to the current time, so that wake ups scheduled before the context is set keep their meaning
+    explicit SimulatedExecutionContext(clock_t::time_point start = clock_t::now());
+
+    // run status
+    // both funcs are safe to call from any thread
+    virtual bool running() const override { return m_running; }
+    virtual void stop() override;
+
+    // safe to call from any thread
+    void wakeUpNow() override;
+    void scheduleNextWakeUp(ms_t timeFromNow) override;
+    void unscheduleNextWakeUp() override;
+
+    // virtual time
+    // safe to call from any thread
+    virtual clock_t::time_point now() const override;
+
+    // consume the pending work and return true if the executor needs an update
+    // if there's no pending work, but a scheduled wake up up to the limit, time jumps to it
+    // return false if there's nothing to do until the limit (time doesn't change in this case)
+    bool next(std::optional<clock_t::time_point> limit = std::nullopt);
+
+    // manually move the virtual time forward
+    // if a scheduled wake up is passed, it becomes pending work
+    void advanceTo(clock_t::time_point time);
+
+private:
+    std::atomic_bool m_running;
+
+    mutable std::mutex m_mutex;
+    clock_t::time_point m_now;
+    bool m_hasWork;
+    std::optional<clock_t::time_point> m_scheduledWakeUpTime;
+};
+
+// drive an executor on the current thread in virtual time
+class XEC_API SimulatedExecution {
+public:
+    explicit SimulatedExecution(ExecutorBase& e, clock_t::time_point start = clock_t::now());
+
+    SimulatedExecutionContext& context() { return *m_context; }
+    clock_t::time_point now() const { return m_context->now(); }
+
+    // all of the following return the number of updates of the executor
+    // if the execution has been stopped, they finalize the executor (once) and return
+
+    // update until there is no work and no scheduled wake ups
+    // WARNING: this never returns if the executor keeps scheduling wake ups (say with a periodic task)
+    size_t runUntilIdle();
+
+    // update, jumping from one wake up to the next, up to the given time
+    // the virtual time is moved to it at the end
+    size_t runUntil(clock_t::time_point time);
+
+    size_t runFor(clock_t::duration duration) { return runUntil(now() + duration); }
+
+    bool finalized() const { return m_finalized; }
+
+private:
+    ExecutorBase& m_executor;
+    SimulatedExecutionContext* m_context = nullptr;
+    bool m_finalized = false;
+
+    size_t run(std::optional<clock_t::time_point> limit);
+};
+
+}
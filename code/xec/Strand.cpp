@@ -0,0 +1,89 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "Strand.hpp"
+#include "PoolExecution.hpp"
+
+#include "bits/hooks.hpp"
+
+#include <cassert>
+
+namespace xec {
+
+struct Strand::Node {
+    Task task;
+    Node* next;
+};
+
+Strand::Strand(PoolExecution& execution)
+    : m_execution(execution)
+    , m_state(0)
+{
+    static_assert(alignof(Node) > Scheduled, "the scheduled bit must fit in the node pointer");
+}
+
+Strand::~Strand() {
+    // free the tasks which were never executed
+    // (only possible if they were posted after the pool was stopped)
+    auto state = m_state.load(std::memory_order_acquire);
+    auto node = reinterpret_cast<Node*>(state & ~Scheduled);
+    while (node) {
+        auto next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+void Strand::post(Task task) {
+    // before pushing, as once the task is executed the strand may be destroyed
+    Hooks::onStrandPost(*this);
+
+    auto node = new Node{std::move(task), nullptr};
+
+    auto state = m_state.load(std::memory_order_relaxed);
+    do {
+        node->next = reinterpret_cast<Node*>(state & ~Scheduled);
+    } while (!m_state.compare_exchange_weak(state, reinterpret_cast<uintptr_t>(node) | Scheduled,
+        std::memory_order_release, std::memory_order_relaxed));
+
+    if (!(state & Scheduled)) {
+        // we're the ones who scheduled the strand, so we're responsible for adding it to the pool
+        m_execution.scheduleStrand(*this);
+    }
+}
+
+void Strand::run() {
+    // grab all tasks posted so far, but stay scheduled so producers don't reschedule us while we're executing
+    auto state = m_state.exchange(Scheduled, std::memory_order_acquire);
+    assert(state & Scheduled);
+
+    // the tasks are in a LIFO stack, reverse them so they're executed in the order they were posted
+    Node* node = nullptr;
+    auto top = reinterpret_cast<Node*>(state & ~Scheduled);
+    while (top) {
+        auto next = top->next;
+        top->next = node;
+        node = top;
+        top = next;
+    }
+
+    while (node) {
+        Hooks::beforeStrandTask(*this);
+        node->task();
+        Hooks::afterStrandTask(*this);
+        auto next = node->next;
+        delete node;
+        node = next;
+    }
+
+    // try to release the strand
+    // if this succeeds, we must not touch it anymore as its owner is now free to destroy it
+    uintptr_t expected = Scheduled;
+    if (m_state.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) return;
+
+    // new tasks were posted while we were executing
+    // instead of looping here, reschedule the strand so it doesn't starve the rest of the pool
+    m_execution.scheduleStrand(*this);
+}
+
+}
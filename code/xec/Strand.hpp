@@ -0,0 +1,64 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "API.h"
+
+#include <itlib/ufunction.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace xec {
+
+class PoolExecution;
+
+// A strand is a minimal serialized task queue which is executed by the workers of a PoolExecution
+// Tasks posted to a strand are executed in the order they were posted (per producer thread)
+// and never concurrently with each other, though they may end up being executed on different workers
+//
+// Unlike executors, strands don't need an execution context and aren't registered with the pool
+// An idle strand is just three words, so it's fine to have hundreds of thousands of them
+// Creating and destroying a strand doesn't touch the pool at all
+//
+// WARNING: a strand must not be destroyed while it has pending tasks (check with idle())
+// WARNING: tasks posted to a strand after its pool has been stopped and joined will never be executed
+class XEC_API Strand {
+public:
+    explicit Strand(PoolExecution& execution);
+    ~Strand();
+
+    Strand(const Strand&) = delete;
+    Strand& operator=(const Strand&) = delete;
+
+    using Task = itlib::ufunction<void()>;
+
+    // valid on any thread, including from a task of the same strand
+    void post(Task task);
+
+    // return true if the strand has no pending or executing tasks
+    // valid on any thread, but naturally the result may be stale if other threads are posting tasks
+    bool idle() const { return m_state.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class PoolExecution;
+
+    PoolExecution& m_execution;
+
+    struct Node;
+
+    // the state is a pointer to the top of a LIFO stack of posted tasks
+    // its lowest bit signifies that the strand is scheduled in the pool (or is currently executing)
+    // keeping both in a single atomic means that once a worker releases the strand, it never touches it again
+    std::atomic_uintptr_t m_state;
+    static constexpr uintptr_t Scheduled = 1;
+
+    // intrusive link for the pool's queue of scheduled strands
+    Strand* m_nextScheduled = nullptr;
+
+    // called by a pool worker
+    // executes all pending tasks and either releases the strand or reschedules it if new ones were posted
+    void run();
+};
+
+}
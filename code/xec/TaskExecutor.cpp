@@ -2,65 +2,572 @@
 // SPDX-License-Identifier: MIT
 //
 #include "TaskExecutor.hpp"
+#include "Heartbeat.hpp"
+
+#include "bits/trace.hpp"
+#include "bits/profile.hpp"
+#include "bits/shrink.hpp"
+#include "bits/hooks.hpp"
 
 #include <cassert>
 #include <atomic>
 #include <algorithm>
+#include <utility>
+#include <memory>
+#include <new>
+#include <thread>
 
 namespace xec {
 
-TaskExecutor::TaskExecutor(ms_t minTimeToSchedule)
-    : m_minTimeToSchedule(minTimeToSchedule) {}
+namespace {
+// the enqueue time of a timed task, which is due at the given time of the executor's clock, on the real clock
+// the start of a task is measured with the real clock, but the executor's one may be virtual (see SimulatedExecution),
+// so we can't subtract times of the two. Instead the lateness of the task is measured with the executor's clock
+// and the time until it's started is added to it
+clock_t::time_point dueTimeOnRealClock(clock_t::time_point dueTime, clock_t::time_point executorNow) {
+    return clock_t::now() - (executorNow - dueTime);
+}
+
+constexpr size_t minCapacityToShrink = 64; // don't bother with small containers
+}
+
+TaskExecutor::TaskExecutor(ms_t minTimeToSchedule, std::pmr::memory_resource* resource)
+    : m_minTimeToSchedule(minTimeToSchedule)
+    , m_resource(resource)
+    , m_taskQueue(resource)
+    , m_queuedTasksByToken(resource)
+    , m_executingTasks(resource)
+    , m_timedTasks(resource)
+    , m_timedTaskBodies(resource)
+    , m_timedTaskProfiles(resource)
+    , m_timedTasksByToken(resource)
+{}
+
+TaskExecutor::~TaskExecutor() {
+    clearStagedTimedTasks(); // in case we were never finalized
 
-struct TaskExecutor::TaskHasCToken {
-    TaskHasCToken(task_ctoken token) : m_token(token) {}
-    bool operator()(const TaskWithId& task) const { return task.ctoken == m_token; }
-    TaskExecutor::task_ctoken m_token;
-};
+    for (uint32_t i = 0; i < m_numStagedChunks; ++i) {
+        const auto size = stagedChunkSize(i);
+        std::destroy_n(m_stagedChunks[i], size);
+        m_resource->deallocate(m_stagedChunks[i], size * sizeof(StagedTimedTask), alignof(StagedTimedTask));
+    }
+}
 
-TaskExecutor::task_id TaskExecutor::getNextTaskIdL() {
-    return m_freeTaskId++;
+TaskExecutor::task_id TaskExecutor::getNextTaskId() {
+    auto ret = m_freeTaskId.fetch_add(1, std::memory_order_relaxed);
+    if (ret == invalid_task_id) {
+        // wrapped around
+        ret = m_freeTaskId.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+void TaskExecutor::TaskQueue::push(TaskWithId task, uint32_t prevWithToken) {
+    const auto index = uint32_t(meta.size());
+    meta.push_back({task.id, task.ctoken, prevWithToken});
+    tasks.push_back(std::move(task.task));
+    if (task.profiled() || Hooks::keepTaskSites || !profiles.empty()) {
+        profile(index) = {task.site, task.enqueueTime};
+    }
+}
+
+TaskExecutor::TaskProfile& TaskExecutor::TaskQueue::profile(uint32_t index) {
+    assert(index < meta.size());
+    if (profiles.size() < meta.size()) {
+        profiles.resize(meta.size()); // the tasks before this one were not profiled
+    }
+    return profiles[index];
+}
+
+void TaskExecutor::TaskQueue::shrink(size_t capacity) {
+    shrinkCapacity(meta, capacity);
+    shrinkCapacity(tasks, capacity);
+    shrinkCapacity(profiles, capacity);
+}
+
+void TaskExecutor::appendToQueueL(TaskWithId task) {
+    static constexpr size_t minTombstonesToCompact = 64; // don't bother with small queues
+    const auto numTombstones = m_taskQueue.size() - m_numQueuedTasks;
+    if (numTombstones > std::max(m_numQueuedTasks, minTombstonesToCompact)) {
+        compactQueueL();
+    }
+
+    const auto index = uint32_t(m_taskQueue.size());
+    uint32_t prevWithToken = npos;
+    if (task.ctoken) {
+        auto& last = m_queuedTasksByToken.try_emplace(task.ctoken, npos).first->second;
+        prevWithToken = last;
+        last = index;
+    }
+    m_taskQueue.push(std::move(task), prevWithToken);
+    ++m_numQueuedTasks;
+}
+
+void TaskExecutor::compactQueueL() {
+    auto& q = m_taskQueue;
+
+    // the chains of tombstones are dropped and the ones of the live tasks are rebuilt as they're moved
+    m_queuedTasksByToken.clear();
+
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < uint32_t(q.size()); ++i) {
+        auto& meta = q.meta[i];
+        if (meta.id == invalid_task_id) continue;
+        meta.prevWithToken = npos;
+        if (meta.ctoken) {
+            auto& last = m_queuedTasksByToken.try_emplace(meta.ctoken, npos).first->second;
+            meta.prevWithToken = last;
+            last = size;
+        }
+        if (i != size) {
+            q.meta[size] = meta;
+            q.tasks[size] = std::move(q.tasks[i]);
+            if (!q.profiles.empty()) {
+                q.profiles[size] = q.profiles[i];
+            }
+        }
+        ++size;
+    }
+    assert(size == m_numQueuedTasks);
+
+    q.meta.erase(q.meta.begin() + size, q.meta.end());
+    q.tasks.erase(q.tasks.begin() + size, q.tasks.end());
+    if (!q.profiles.empty()) {
+        q.profiles.erase(q.profiles.begin() + size, q.profiles.end());
+    }
+    m_oldestQueuedTask = 0;
+}
+
+void TaskExecutor::cancelQueuedTaskL(uint32_t index) {
+    auto& meta = m_taskQueue.meta[index];
+    assert(meta.id != invalid_task_id);
+    // leave a tombstone
+    // the token and the chain link are kept intact, so chains going through this task are not broken
+    m_taskQueue.tasks[index] = {};
+    meta.id = invalid_task_id;
+    --m_numQueuedTasks;
+}
+
+size_t TaskExecutor::cancelQueuedTasksWithTokenL(task_ctoken token) {
+    auto f = m_queuedTasksByToken.find(token);
+    if (f == m_queuedTasksByToken.end()) return 0;
+
+    size_t ret = 0;
+    for (auto i = f->second; i != npos; i = m_taskQueue.meta[i].prevWithToken) {
+        if (m_taskQueue.meta[i].id == invalid_task_id) continue; // already cancelled
+        cancelQueuedTaskL(i);
+        ++ret;
+    }
+
+    // the entire chain consists of tombstones now, so drop it
+    m_queuedTasksByToken.erase(f);
+    return ret;
+}
+
+uint32_t TaskExecutor::findLastQueuedTaskWithTokenL(task_ctoken token) {
+    auto f = m_queuedTasksByToken.find(token);
+    if (f == m_queuedTasksByToken.end()) return npos;
+    for (auto i = f->second; i != npos; i = m_taskQueue.meta[i].prevWithToken) {
+        if (m_taskQueue.meta[i].id != invalid_task_id) return i;
+    }
+    return npos;
+}
+
+void TaskExecutor::addTimedTaskL(clock_t::time_point time, TaskWithId task) {
+    const auto token = task.ctoken;
+    const auto slot = m_timedTasks.push(time, {task.id, token, npos, npos});
+    if (slot >= m_timedTaskBodies.size()) {
+        m_timedTaskBodies.resize(m_timedTasks.numSlots());
+    }
+    m_timedTaskBodies[slot] = std::move(task.task);
+    if (task.profiled() || Hooks::keepTaskSites || !m_timedTaskProfiles.empty()) {
+        if (m_timedTaskProfiles.size() < m_timedTasks.numSlots()) {
+            m_timedTaskProfiles.resize(m_timedTasks.numSlots()); // the tasks before this one were not profiled
+        }
+        m_timedTaskProfiles[slot] = {task.site, task.enqueueTime};
+    }
+    m_highWaterMarks[0].timed = std::max(m_highWaterMarks[0].timed, m_timedTasks.size());
+
+    if (token) {
+        // add to the head of the list for this token
+        auto& head = m_timedTasksByToken.try_emplace(token, npos).first->second;
+        if (head != npos) {
+            m_timedTasks[head].prevWithToken = slot;
+            m_timedTasks[slot].nextWithToken = head;
+        }
+        head = slot;
+    }
+}
+
+TaskExecutor::TaskWithId TaskExecutor::extractTimedTaskL(timed_slot slot) {
+    auto& task = m_timedTasks[slot];
+
+    if (task.ctoken) {
+        // unlink from the list for this token
+        if (task.prevWithToken != npos) {
+            m_timedTasks[task.prevWithToken].nextWithToken = task.nextWithToken;
+        }
+        else if (task.nextWithToken != npos) {
+            m_timedTasksByToken[task.ctoken] = task.nextWithToken;
+        }
+        else {
+            m_timedTasksByToken.erase(task.ctoken);
+        }
+
+        if (task.nextWithToken != npos) {
+            m_timedTasks[task.nextWithToken].prevWithToken = task.prevWithToken;
+        }
+    }
+
+    auto& body = m_timedTaskBodies[slot];
+    TaskWithId ret{std::move(body), task.id, task.ctoken, {}, {}};
+    body = {}; // don't keep anything alive in free slots
+    if (slot < m_timedTaskProfiles.size()) {
+        ret.site = m_timedTaskProfiles[slot].site;
+        ret.enqueueTime = m_timedTaskProfiles[slot].enqueueTime;
+    }
+    m_timedTasks.extract(slot);
+    if (m_timedTasks.empty()) {
+        m_timedTaskProfiles.clear(); // so they're no longer filled if profiling has been disabled
+    }
+    return ret;
+}
+
+void TaskExecutor::mergeStagedTimedTasksL() {
+    auto staged = m_stagedTimedTasks.exchange(nullptr);
+
+    // reverse the stack, so tasks are added in the order they were scheduled
+    StagedTimedTask* prev = nullptr;
+    while (staged) {
+        prev = std::exchange(staged, std::exchange(staged->next, prev));
+    }
+    staged = prev;
+
+    if (!staged) return;
+
+    auto first = staged;
+    size_t numMerged = 1;
+    while (true) {
+        addTimedTaskL(staged->time, std::move(staged->task));
+        staged->task.task = {}; // don't keep the captures
+        if (!staged->next) break;
+        ++numMerged;
+        staged->nextFree.store(staged->next->index, std::memory_order_relaxed);
+        staged = staged->next;
+    }
+    pushFreeStagedTasks(*first, *staged);
+    m_highWaterMarks[0].staged = std::max(m_highWaterMarks[0].staged, numMerged);
+}
+
+void TaskExecutor::clearStagedTimedTasks() {
+    auto staged = m_stagedTimedTasks.exchange(nullptr);
+    if (!staged) return;
+
+    auto first = staged;
+    while (true) {
+        staged->task.task = {};
+        if (!staged->next) break;
+        staged->nextFree.store(staged->next->index, std::memory_order_relaxed);
+        staged = staged->next;
+    }
+    pushFreeStagedTasks(*first, *staged);
+}
+
+TaskExecutor::StagedTimedTask& TaskExecutor::stagedTask(uint32_t index) {
+    uint32_t chunk = 0;
+    while (index >= stagedChunkBegin(chunk + 1)) ++chunk;
+    return m_stagedChunks[chunk][index - stagedChunkBegin(chunk)];
+}
+
+TaskExecutor::StagedTimedTask* TaskExecutor::popFreeStagedTask() {
+    // we may read nodes which other producers pop before us, so count ourselves for shrinkStagedTasksL
+    // which waits for us before releasing a chunk (both are seq_cst, so it can't miss us after taking the list)
+    m_numPoppingProducers.fetch_add(1);
+
+    StagedTimedTask* ret = nullptr;
+    auto head = m_freeStagedTasks.load();
+    while (uint32_t(head) != npos) {
+        auto& node = stagedTask(uint32_t(head));
+
+        // the tag changes with every push and pop, so this fails if the node has been popped in the meantime
+        // even if it has been pushed back since
+        const uint64_t newHead = ((head >> 32) + 1) << 32 | node.nextFree.load(std::memory_order_relaxed);
+        if (m_freeStagedTasks.compare_exchange_weak(head, newHead, std::memory_order_acquire)) {
+            ret = &node;
+            break;
+        }
+    }
+
+    m_numPoppingProducers.fetch_sub(1, std::memory_order_release);
+    return ret;
+}
+
+void TaskExecutor::pushFreeStagedTasks(StagedTimedTask& first, StagedTimedTask& last) {
+    auto head = m_freeStagedTasks.load(std::memory_order_relaxed);
+    while (true) {
+        last.nextFree.store(uint32_t(head), std::memory_order_relaxed);
+        const uint64_t newHead = ((head >> 32) + 1) << 32 | first.index;
+        if (m_freeStagedTasks.compare_exchange_weak(head, newHead, std::memory_order_release)) {
+            return;
+        }
+    }
+}
+
+void TaskExecutor::addStagedChunkL() {
+    assert(m_tasksLocked);
+    if (m_numStagedChunks == MaxStagedChunks) return; // keep using the lock
+
+    const auto chunkBegin = stagedChunkBegin(m_numStagedChunks);
+    const auto size = stagedChunkSize(m_numStagedChunks);
+    auto chunk = static_cast<StagedTimedTask*>(m_resource->allocate(size * sizeof(StagedTimedTask), alignof(StagedTimedTask)));
+    for (uint32_t i = 0; i < size; ++i) {
+        auto node = new (chunk + i) StagedTimedTask;
+        node->index = chunkBegin + i;
+        if (i + 1 < size) {
+            node->nextFree.store(chunkBegin + i + 1, std::memory_order_relaxed);
+        }
+    }
+    m_stagedChunks[m_numStagedChunks++] = chunk;
+
+    pushFreeStagedTasks(chunk[0], chunk[size - 1]);
+}
+
+void TaskExecutor::shrinkStagedTasksL(size_t mark) {
+    const auto capacity = stagedChunkBegin(m_numStagedChunks);
+    if (capacity <= minCapacityToShrink || capacity <= m_shrinkFactor * mark) return;
+
+    // take the free list, so no producer can pop from it anymore (they'll find it empty and wait for the lock),
+    // and wait for the ones which are popping, as they may be reading nodes from it
+    auto head = m_freeStagedTasks.load();
+    while (!m_freeStagedTasks.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | npos));
+    while (m_numPoppingProducers.load() != 0) std::this_thread::yield();
+
+    // trailing chunks can be released if all their nodes are free
+    uint32_t numFree[MaxStagedChunks] = {};
+    for (auto i = uint32_t(head); i != npos; i = stagedTask(i).nextFree.load(std::memory_order_relaxed)) {
+        uint32_t chunk = 0;
+        while (i >= stagedChunkBegin(chunk + 1)) ++chunk;
+        ++numFree[chunk];
+    }
+    auto numChunks = m_numStagedChunks;
+    while (numChunks > 1 && numFree[numChunks - 1] == stagedChunkSize(numChunks - 1)
+        && stagedChunkBegin(numChunks - 1) >= mark)
+    {
+        --numChunks;
+    }
+
+    // return the nodes of the remaining chunks
+    const auto end = stagedChunkBegin(numChunks);
+    StagedTimedTask* first = nullptr;
+    StagedTimedTask* last = nullptr;
+    for (auto i = uint32_t(head); i != npos; ) {
+        auto& node = stagedTask(i);
+        i = node.nextFree.load(std::memory_order_relaxed);
+        if (node.index >= end) continue;
+        if (last) {
+            last->nextFree.store(node.index, std::memory_order_relaxed);
+        }
+        else {
+            first = &node;
+        }
+        last = &node;
+    }
+    if (first) {
+        pushFreeStagedTasks(*first, *last);
+    }
+
+    while (m_numStagedChunks > numChunks) {
+        const auto c = --m_numStagedChunks;
+        const auto size = stagedChunkSize(c);
+        std::destroy_n(m_stagedChunks[c], size);
+        m_resource->deallocate(m_stagedChunks[c], size * sizeof(StagedTimedTask), alignof(StagedTimedTask));
+        m_stagedChunks[c] = nullptr;
+    }
 }
 
 void TaskExecutor::fillExecutingTasksL() {
     assert(m_executingTasks.empty());
     m_executingTasks.swap(m_taskQueue);
+    m_highWaterMarks[0].queued = std::max(m_highWaterMarks[0].queued, m_executingTasks.size());
+    m_numQueuedTasks = 0;
+    m_oldestQueuedTask = 0;
+    if (!m_queuedTasksByToken.empty()) {
+        m_queuedTasksByToken.clear();
+    }
+}
+
+void TaskExecutor::executeTask(const QueuedTaskMeta& meta, Task& task, const TaskProfile& profile) {
+    auto hb = heartbeat();
+    XEC_TRACE(TaskBegin, this, meta.id, meta.ctoken);
+    if (hb) hb->beginTask(meta.id, meta.ctoken);
+    Hooks::beforeTask(*this, meta.id, meta.ctoken, profile.site);
+    if (profile.enqueueTime != clock_t::time_point{} && profile::g_enabled.load(std::memory_order_relaxed)) {
+        const auto start = clock_t::now();
+        task();
+        const auto end = clock_t::now();
+        const auto queueDelay = std::max(start - profile.enqueueTime, clock_t::duration{}); // scheduled tasks may be executed a bit early
+        profile::record(profile.site, end - start, queueDelay);
+    }
+    else {
+        task();
+    }
+    Hooks::afterTask(*this, meta.id, meta.ctoken, profile.site);
+    if (hb) hb->endTask();
+    XEC_TRACE(TaskEnd, this, 0, 0);
 }
 
 void TaskExecutor::executeTasks() {
-    for (auto& task : m_executingTasks) {
-        task.task();
+    for (size_t i = 0; i < m_executingTasks.size(); ++i) {
+        auto& meta = m_executingTasks.meta[i];
+        if (meta.id == invalid_task_id) continue; // tombstone
+        executeTask(meta, m_executingTasks.tasks[i], m_executingTasks.profileAt(uint32_t(i)));
     }
     m_executingTasks.clear();
 }
 
+void TaskExecutor::setShrinkPolicy(ms_t window, size_t factor) {
+    std::lock_guard<std::mutex> l(m_tasksMutex);
+    m_shrinkWindow = window;
+    m_shrinkFactor = factor;
+    m_shrinkWindowStart = now();
+    m_highWaterMarks[0] = m_highWaterMarks[1] = {};
+}
+
+void TaskExecutor::shrinkContainersL() {
+    const auto now = this->now();
+    if (now - m_shrinkWindowStart < m_shrinkWindow) return;
+    m_shrinkWindowStart = now;
+
+    // the marks of the sliding window are the ones of the current and the previous window
+    auto& cur = m_highWaterMarks[0];
+    auto& prev = m_highWaterMarks[1];
+    cur.queued = std::max(cur.queued, m_taskQueue.size());
+    cur.timed = std::max(cur.timed, m_timedTasks.size());
+    const auto queuedMark = std::max(cur.queued, prev.queued);
+    const auto timedMark = std::max(cur.timed, prev.timed);
+    const auto stagedMark = std::max(cur.staged, prev.staged);
+    prev = cur;
+    cur = {};
+
+    auto overProvisioned = [&](size_t capacity, size_t mark) {
+        return capacity > minCapacityToShrink && capacity > m_shrinkFactor * mark;
+    };
+
+    const auto queueCapacity = std::max(queuedMark, minCapacityToShrink);
+    if (overProvisioned(m_taskQueue.capacity(), queuedMark)) {
+        m_taskQueue.shrink(queueCapacity);
+    }
+    // we're called before the executing tasks are filled, so they're empty and shrinking them is cheap
+    if (overProvisioned(m_executingTasks.capacity(), queuedMark)) {
+        m_executingTasks.shrink(queueCapacity);
+    }
+    if (overProvisioned(m_timedTasks.capacity(), timedMark)) {
+        const auto timedCapacity = std::max(timedMark, minCapacityToShrink);
+        m_timedTasks.shrink(timedCapacity);
+        m_timedTaskBodies.resize(m_timedTasks.numSlots()); // the dropped slots were free, so their bodies are empty
+        shrinkCapacity(m_timedTaskBodies, timedCapacity);
+        if (m_timedTaskProfiles.size() > m_timedTasks.numSlots()) {
+            m_timedTaskProfiles.resize(m_timedTasks.numSlots());
+        }
+        shrinkCapacity(m_timedTaskProfiles, timedCapacity);
+    }
+    shrinkStagedTasksL(stagedMark);
+}
+
+bool TaskExecutor::hasSurplusCapacityL() const {
+    // we're called after the executing tasks are filled, but they'll be cleared after executing
+    // so what remains for the next update are the queued tasks and the scheduled ones
+    auto surplus = [&](size_t capacity, size_t size) {
+        return capacity > minCapacityToShrink && capacity > m_shrinkFactor * size;
+    };
+    return surplus(m_taskQueue.capacity(), m_taskQueue.size())
+        || surplus(m_executingTasks.capacity(), m_taskQueue.size())
+        // timed slots in use are never moved, so only the capacity beyond the last one can be released
+        || surplus(m_timedTasks.capacity(), m_timedTasks.numUsedSlots())
+        || surplus(stagedChunkBegin(m_numStagedChunks), 0);
+}
+
+void TaskExecutor::updateReservedBytesL() {
+    const auto bytes = m_taskQueue.reservedBytes() + m_executingTasks.reservedBytes()
+        + m_timedTasks.reservedBytes() + m_timedTaskBodies.capacity() * sizeof(Task)
+        + m_timedTaskProfiles.capacity() * sizeof(TaskProfile)
+        + stagedChunkBegin(m_numStagedChunks) * sizeof(StagedTimedTask);
+    m_reservedBytes.store(bytes, std::memory_order_relaxed);
+}
+
 void TaskExecutor::update() {
     m_tasksMutex.lock();
+    if (m_shrinkWindow.count()) {
+        shrinkContainersL();
+    }
     fillExecutingTasksL();
+    mergeStagedTimedTasksL();
 
+    auto toWait = clock_t::duration::max(); // until the next wake up
     if (!m_timedTasks.empty()) {
-        const auto now = clock_t::now();
+        const auto now = this->now();
         const auto maxTimeToExecute = now + m_minTimeToSchedule;
+        uint64_t numDue = 0;
         while (true) {
-            auto& top = m_timedTasks.top();
-            if (top.time <= maxTimeToExecute) {
-                auto& nt = m_executingTasks.emplace_back();
-                nt.task = m_timedTasks.topAndPop().task;
+            const auto topTime = m_timedTasks.topTime();
+            if (topTime <= maxTimeToExecute) {
+                auto task = extractTimedTaskL(m_timedTasks.topSlot());
+                if (task.profiled()) {
+                    // queueing delay of timed tasks is measured from the time they're scheduled for
+                    task.enqueueTime = dueTimeOnRealClock(topTime, now);
+                }
+                m_executingTasks.push(std::move(task), npos);
+                ++numDue;
                 if (m_timedTasks.empty()) {
                     unscheduleNextWakeUp();
                     break;
                 }
             }
             else {
-                const auto toWait = top.time - now;
-                scheduleNextWakeUp(std::chrono::duration_cast<ms_t>(toWait));
+                // tasks which are due until the slacked time will be executed together with this one
+                toWait = applyTimerSlack(topTime, m_timerSlack) - now;
                 break;
             }
         }
+
+        if (numDue) {
+            m_numTimerFires.store(m_numTimerFires.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            m_numTimedTasks.store(m_numTimedTasks.load(std::memory_order_relaxed) + numDue, std::memory_order_relaxed);
+        }
+    }
+
+    if (m_shrinkWindow.count() && hasSurplusCapacityL()) {
+        // an idle executor isn't updated, so wake up for the next check, otherwise the surplus would be kept forever
+        const auto toCheck = m_shrinkWindowStart + m_shrinkWindow - now();
+        toWait = std::min(toWait, std::max(toCheck, clock_t::duration::zero()));
+    }
+
+    if (toWait != clock_t::duration::max()) {
+        // round up, so we don't wake up before the task is due
+        // (with a virtual clock or a zero minTimeToSchedule we would end up waking up again and again)
+        scheduleNextWakeUp(std::chrono::ceil<ms_t>(toWait));
     }
 
+    m_earliestTimedTask = m_timedTasks.empty() ? std::numeric_limits<clock_t::rep>::max()
+        : m_timedTasks.topTime().time_since_epoch().count();
+
+    // a task may have been staged after we merged, but before we updated the earliest time
+    // in such case its producer may not have woken us up, so do it ourselves
+    const bool stagedMore = m_stagedTimedTasks.load() != nullptr;
+
+    updateQueueDepthL();
+    updateReservedBytesL();
+    const bool notifyProducers = m_numBlockedProducers;
     m_tasksMutex.unlock();
 
+    if (notifyProducers) {
+        m_queueHasRoomCV.notify_all();
+    }
+
+    if (stagedMore) {
+        wakeUpNow();
+    }
+
     executeTasks();
 }
 
@@ -70,93 +577,309 @@ void TaskExecutor::lockTasks() {
 }
 
 void TaskExecutor::unlockTasks() {
+    updateQueueDepthL();
     m_tasksLocked = false;
     m_tasksMutex.unlock();
     wakeUpNow(); // assume something has changed
 }
 
-TaskExecutor::task_id TaskExecutor::pushTaskL(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken) {
+void TaskExecutor::setTimerSlack(ms_t slack) {
+    std::lock_guard<std::mutex> l(m_tasksMutex);
+    m_timerSlack = slack;
+}
+
+TaskExecutor::TimerStats TaskExecutor::timerStats() const {
+    TimerStats ret;
+    ret.numTimerFires = m_numTimerFires.load(std::memory_order_relaxed);
+    ret.numTimedTasks = m_numTimedTasks.load(std::memory_order_relaxed);
+    return ret;
+}
+
+void TaskExecutor::setCapacity(size_t capacity, OverflowPolicy policy) {
+    {
+        std::lock_guard<std::mutex> l(m_tasksMutex);
+        m_capacity = capacity;
+        m_overflowPolicy = policy;
+    }
+    // the capacity may have increased, or we may no longer block
+    m_queueHasRoomCV.notify_all();
+}
+
+bool TaskExecutor::makeRoomL(task_ctoken ownToken, bool canBlock) {
+    if (!m_capacity || m_numQueuedTasks < m_capacity) return true;
+
+    switch (m_overflowPolicy) {
+    case OverflowPolicy::Block: {
+        if (!canBlock) return false;
+        // we're called with the mutex locked, so adopt it for the wait and release it afterwards
+        // NOTE: this breaks the atomicity of a locked batch (documented in TaskLocker)
+        std::unique_lock<std::mutex> lock(m_tasksMutex, std::adopt_lock);
+        ++m_numBlockedProducers;
+        m_queueHasRoomCV.wait(lock, [this] {
+            return !m_capacity || m_numQueuedTasks < m_capacity || m_overflowPolicy != OverflowPolicy::Block;
+        });
+        --m_numBlockedProducers;
+        lock.release();
+        m_tasksLocked = true; // other producers may have locked and unlocked while we waited
+        return makeRoomL(ownToken, canBlock); // the policy may have changed while waiting
+    }
+    case OverflowPolicy::Reject:
+        return false;
+    case OverflowPolicy::DropOldest:
+        while (m_taskQueue.meta[m_oldestQueuedTask].id == invalid_task_id) {
+            ++m_oldestQueuedTask;
+        }
+        cancelQueuedTaskL(uint32_t(m_oldestQueuedTask));
+        ++m_oldestQueuedTask;
+        return true;
+    case OverflowPolicy::Coalesce:
+        if (!ownToken) return false;
+        return cancelQueuedTasksWithTokenL(ownToken) > 0;
+    }
+
+    return false;
+}
+
+TaskExecutor::task_id TaskExecutor::pushTaskL(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site) {
+    return doPushTaskL(std::move(task), ownToken, tasksToCancelToken, site, true);
+}
+
+TaskExecutor::task_id TaskExecutor::tryPushTaskL(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site) {
+    return doPushTaskL(std::move(task), ownToken, tasksToCancelToken, site, false);
+}
+
+TaskExecutor::task_id TaskExecutor::doPushTaskL(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site, bool canBlock) {
     assert(m_tasksLocked);
     cancelTasksWithTokenL(tasksToCancelToken);
 
-    auto& newTask = m_taskQueue.emplace_back();
-    newTask.task = std::move(task);
-    newTask.id = getNextTaskIdL();
-    newTask.ctoken = ownToken;
-    return newTask.id;
+    if (!makeRoomL(ownToken, canBlock)) return invalid_task_id;
+
+    const auto id = getNextTaskId();
+    appendToQueueL({std::move(task), id, ownToken, site, profile::enqueueTime()});
+    Hooks::onEnqueue(*this, id, ownToken, site, ms_t(0));
+    return id;
 }
 
-TaskExecutor::task_id TaskExecutor::scheduleTaskL(ms_t timeFromNow, Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken) {
+TaskExecutor::task_id TaskExecutor::pushOrReplaceTaskL(Task task, task_ctoken key, TaskSite site) {
+    assert(m_tasksLocked);
+    if (key) {
+        const auto i = findLastQueuedTaskWithTokenL(key);
+        if (i != npos) {
+            m_taskQueue.tasks[i] = std::move(task);
+
+            // the replacement is an enqueue of the same task with a new body and site
+            const auto enqueueTime = profile::enqueueTime();
+            if (enqueueTime != clock_t::time_point{} || Hooks::keepTaskSites || i < m_taskQueue.profiles.size()) {
+                auto& p = m_taskQueue.profile(i);
+                p.site = site;
+                // the enqueue time is kept, as the new task takes the old one's place in the queue
+                if (p.enqueueTime == clock_t::time_point{}) {
+                    p.enqueueTime = enqueueTime;
+                }
+            }
+
+            const auto id = m_taskQueue.meta[i].id;
+            Hooks::onEnqueue(*this, id, key, site, ms_t(0));
+            return id;
+        }
+    }
+    return pushTaskL(std::move(task), key, 0, site);
+}
+
+TaskExecutor::task_id TaskExecutor::scheduleTask(ms_t timeFromNow, Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site) {
+    if (tasksToCancelToken || timeFromNow < m_minTimeToSchedule) {
+        // these need the lock
+        return taskLocker().scheduleTask(timeFromNow, std::move(task), ownToken, tasksToCancelToken, site);
+    }
+
+    auto staged = popFreeStagedTask();
+    if (!staged) {
+        // out of nodes, so allocate more for the next ones and schedule this task with the lock
+        auto locker = taskLocker();
+        addStagedChunkL();
+        return locker.scheduleTask(timeFromNow, std::move(task), ownToken, tasksToCancelToken, site);
+    }
+
+    const auto id = getNextTaskId();
+    const auto time = now() + timeFromNow;
+    staged->task = {std::move(task), id, ownToken, site, profile::enqueueTime()};
+    staged->time = time;
+    staged->next = m_stagedTimedTasks.load(std::memory_order_relaxed);
+    while (!m_stagedTimedTasks.compare_exchange_weak(staged->next, staged));
+
+    // wake up only if this is the earliest task
+    // the update will merge it and schedule the wake up for it
+    const auto rep = time.time_since_epoch().count();
+    auto earliest = m_earliestTimedTask.load();
+    while (rep < earliest) {
+        if (m_earliestTimedTask.compare_exchange_weak(earliest, rep)) {
+            wakeUpNow();
+            break;
+        }
+    }
+
+    Hooks::onEnqueue(*this, id, ownToken, site, timeFromNow);
+    return id;
+}
+
+TaskExecutor::task_id TaskExecutor::scheduleTaskL(ms_t timeFromNow, Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site) {
     // no point in scheduling something which is about to happen so soon
     if (timeFromNow < m_minTimeToSchedule) {
-        return pushTaskL(std::move(task));
+        return pushTaskL(std::move(task), 0, 0, site);
     }
 
     assert(m_tasksLocked);
     cancelTasksWithTokenL(tasksToCancelToken);
-    const auto newId = getNextTaskIdL();
-    TimedTaskWithId newTask;
-    newTask.task = std::move(task);
-    newTask.id = newId;
-    newTask.ctoken = ownToken;
-    newTask.time = clock_t::now() + timeFromNow;
-    m_timedTasks.emplace(std::move(newTask));
+    const auto newId = getNextTaskId();
+    addTimedTaskL(now() + timeFromNow, {std::move(task), newId, ownToken, site, profile::enqueueTime()});
+    Hooks::onEnqueue(*this, newId, ownToken, site, timeFromNow);
     return newId;
 }
 
 bool TaskExecutor::cancelTask(task_id id) {
     std::lock_guard<std::mutex> l(m_tasksMutex);
-    return cancelTaskL(id);
+    auto ret = cancelTaskL(id);
+    updateQueueDepthL();
+    return ret;
 }
 
 bool TaskExecutor::cancelTaskL(task_id id) {
-    for (auto taskIter = m_taskQueue.cbegin(); taskIter != m_taskQueue.cend(); ++taskIter)  {
-        if (taskIter->id == id) {
-            m_taskQueue.erase(taskIter);
+    if (id == invalid_task_id) return false; // don't match tombstones
+    mergeStagedTimedTasksL();
+
+    for (uint32_t i = 0; i < uint32_t(m_taskQueue.size()); ++i) {
+        if (m_taskQueue.meta[i].id == id) {
+            cancelQueuedTaskL(i);
             return true;
         }
     }
 
-    return !!m_timedTasks.tryExtract(TaskWithId::ById{id});
+    auto slot = m_timedTasks.find([id](const TimedTaskMeta& t) { return t.id == id; });
+    if (slot == m_timedTasks.npos) return false;
+    extractTimedTaskL(slot);
+    return true;
 }
 
 bool TaskExecutor::rescheduleTaskL(ms_t timeFromNow, task_id id) {
+    mergeStagedTimedTasksL();
+    auto slot = m_timedTasks.find([id](const TimedTaskMeta& t) { return t.id == id; });
+    if (slot == m_timedTasks.npos) return false;
+
     if (timeFromNow < m_minTimeToSchedule) {
-        auto t = m_timedTasks.tryExtract(TaskWithId::ById{id});
-        if (!t) return false;
-        m_taskQueue.emplace_back(std::move(*t)); // slice
-        return true;
+        auto task = extractTimedTaskL(slot);
+        if (task.profiled()) {
+            task.enqueueTime = profile::enqueueTime();
+        }
+        appendToQueueL(std::move(task));
     }
     else {
-        auto newTime = clock_t::now() + timeFromNow;
-        return m_timedTasks.tryReschedule(newTime, TaskWithId::ById{id});
+        m_timedTasks.reschedule(slot, now() + timeFromNow);
     }
+    return true;
 }
 
 size_t TaskExecutor::cancelTasksWithToken(task_ctoken token) {
     if (!token) return 0; // prevent lock on invalid token
     std::lock_guard<std::mutex> l(m_tasksMutex);
-    return cancelTasksWithTokenL(token);
+    auto ret = cancelTasksWithTokenL(token);
+    updateQueueDepthL();
+    return ret;
 }
 
 size_t TaskExecutor::cancelTasksWithTokenL(task_ctoken token) {
     if (!token) return 0;
-    auto newEnd = std::remove_if(m_taskQueue.begin(), m_taskQueue.end(), TaskHasCToken(token));
-    auto size = m_taskQueue.end() - newEnd;
-    m_taskQueue.erase(newEnd, m_taskQueue.end());
-    return size + m_timedTasks.eraseAll(TaskWithId::ByCToken{token});
+    mergeStagedTimedTasksL();
+    auto ret = cancelQueuedTasksWithTokenL(token);
+
+    while (true) {
+        auto f = m_timedTasksByToken.find(token);
+        if (f == m_timedTasksByToken.end()) break;
+        extractTimedTaskL(f->second); // this also updates the head of the list
+        ++ret;
+    }
+
+    return ret;
+}
+
+void TaskExecutor::setDrainOnExit(ms_t gracePeriod, ms_t deadline) {
+    m_drainOnExit = true;
+    m_drainGracePeriod = gracePeriod;
+    m_drainDeadline = deadline;
+}
+
+void TaskExecutor::drain() {
+    const auto start = clock_t::now();
+    const auto deadline = start + m_drainDeadline;
+    const auto graceEnd = now() + m_drainGracePeriod; // the clock of the executor (which may be virtual)
+
+    auto& report = m_drainReport;
+    report = {};
+
+    // like finishing tasks on exit, loop until there are no more tasks (since tasks can add other tasks)
+    while (!report.deadlineReached) {
+        m_tasksMutex.lock();
+        fillExecutingTasksL();
+        mergeStagedTimedTasksL();
+        while (!m_timedTasks.empty() && m_timedTasks.topTime() <= graceEnd) {
+            const auto topTime = m_timedTasks.topTime();
+            auto task = extractTimedTaskL(m_timedTasks.topSlot());
+            if (task.profiled()) {
+                task.enqueueTime = dueTimeOnRealClock(topTime, now()); // as in update
+            }
+            m_executingTasks.push(std::move(task), npos);
+        }
+        updateQueueDepthL();
+        const bool notifyProducers = m_numBlockedProducers;
+        m_tasksMutex.unlock();
+
+        if (notifyProducers) {
+            m_queueHasRoomCV.notify_all();
+        }
+
+        if (m_executingTasks.empty()) break;
+
+        for (size_t i = 0; i < m_executingTasks.size(); ++i) {
+            auto& meta = m_executingTasks.meta[i];
+            if (meta.id == invalid_task_id) continue; // tombstone
+            if (report.deadlineReached || clock_t::now() >= deadline) {
+                report.deadlineReached = true;
+                ++report.numDropped;
+                continue;
+            }
+            executeTask(meta, m_executingTasks.tasks[i], m_executingTasks.profileAt(uint32_t(i)));
+            ++report.numExecuted;
+        }
+        m_executingTasks.clear();
+    }
+
+    // what's left will be cleared in finalize
+    {
+        std::lock_guard<std::mutex> l(m_tasksMutex);
+        mergeStagedTimedTasksL();
+        report.numDropped += m_numQueuedTasks + m_timedTasks.size();
+    }
+    report.duration = clock_t::now() - start;
 }
 
 void TaskExecutor::finalize() {
-    if (m_finishTasksOnExit) {
+    if (m_drainOnExit) {
+        drain();
+    }
+    else if (m_finishTasksOnExit) {
         // since tasks can add other tasks, we need to loop mulitple times until we're done
         // we also intentionally ignore scheduled tasks in this context
         // (since they're not executed immediately, they are not considered essential)
         while (true) {
             m_tasksMutex.lock();
             fillExecutingTasksL();
+            updateQueueDepthL();
+            const bool notifyProducers = m_numBlockedProducers;
             m_tasksMutex.unlock();
 
+            if (notifyProducers) {
+                m_queueHasRoomCV.notify_all();
+            }
+
             if (m_executingTasks.empty()) break;
 
             executeTasks();
@@ -164,9 +887,73 @@ void TaskExecutor::finalize() {
     }
 
     // whether we finish tasks or not, we clear them all in case they're holding some references
-    std::lock_guard<std::mutex> l(m_tasksMutex);
-    m_taskQueue.clear();
-    m_timedTasks.clear();
+    {
+        std::lock_guard<std::mutex> l(m_tasksMutex);
+        m_taskQueue.clear();
+        m_numQueuedTasks = 0;
+        m_oldestQueuedTask = 0;
+        m_queuedTasksByToken.clear();
+        m_timedTasks.clear();
+        m_timedTaskBodies.clear();
+        m_timedTaskProfiles.clear();
+        m_timedTasksByToken.clear();
+        clearStagedTimedTasks();
+        m_earliestTimedTask = std::numeric_limits<clock_t::rep>::max();
+        updateQueueDepthL();
+
+        // no one will make room for blocked producers anymore, so stop blocking
+        m_capacity = 0;
+    }
+    m_queueHasRoomCV.notify_all();
+}
+
+TaskExecutor::SubmissionBuffer::SubmissionBuffer(TaskExecutor& executor, size_t flushThreshold)
+    : m_executor(&executor)
+    , m_flushThreshold(flushThreshold)
+{}
+
+TaskExecutor::SubmissionBuffer::SubmissionBuffer(SubmissionBuffer&& other) noexcept
+    : m_executor(other.m_executor)
+    , m_flushThreshold(other.m_flushThreshold)
+    , m_tasks(std::move(other.m_tasks))
+{
+    other.m_executor = nullptr;
+    other.m_tasks.clear();
+}
+
+TaskExecutor::SubmissionBuffer::~SubmissionBuffer() {
+    if (m_executor) flush();
+}
+
+TaskExecutor::task_id TaskExecutor::SubmissionBuffer::pushTask(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site) {
+    const auto id = m_executor->getNextTaskId();
+    m_tasks.push_back({{std::move(task), id, ownToken, site, profile::enqueueTime()}, tasksToCancelToken});
+    if (m_tasks.size() >= m_flushThreshold) {
+        flush();
+    }
+    return id;
+}
+
+void TaskExecutor::SubmissionBuffer::flush() {
+    if (m_tasks.empty()) return;
+
+    {
+        // unlocking will wake the executor up once for all tasks
+        auto locker = m_executor->taskLocker();
+        auto& e = *m_executor;
+        for (auto& b : m_tasks) {
+            // same as doPushTaskL, but the id is already given
+            e.cancelTasksWithTokenL(b.tasksToCancelToken);
+            if (!e.makeRoomL(b.task.ctoken, true)) continue;
+            const auto id = b.task.id;
+            const auto ctoken = b.task.ctoken;
+            const auto site = b.task.site;
+            e.appendToQueueL(std::move(b.task));
+            Hooks::onEnqueue(e, id, ctoken, site, ms_t(0));
+        }
+    }
+
+    m_tasks.clear();
 }
 
 }
@@ -5,12 +5,18 @@
 #include "API.h"
 
 #include "ExecutorBase.hpp"
-#include "bits/TimedQueue.hpp"
+#include "TaskProfiling.hpp"
+#include "bits/IndexedTimedQueue.hpp"
 
 #include <itlib/ufunction.hpp>
 
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <vector>
+#include <unordered_map>
+#include <memory_resource>
+#include <limits>
 
 namespace xec {
 
@@ -18,13 +24,53 @@ class XEC_API TaskExecutor : public ExecutorBase {
 public:
     // When scheduling tasks we use minTimeToSchedule to decide whether to schedule the task for later
     // or to execute it right away
-    explicit TaskExecutor(ms_t minTimeToSchedule = ms_t(20));
+    // The internal containers (task queues, timers, token maps and staged tasks) allocate from the given memory resource
+    // It's only used while the tasks are locked (or on destruction), so it doesn't need to be thread safe
+    // NOTE: the captures of tasks, which don't fit in the task object, are still allocated by the task itself
+    //       (with the global allocator)
+    // WARNING: the resource must outlive the executor
+    explicit TaskExecutor(ms_t minTimeToSchedule = ms_t(20), std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    ~TaskExecutor();
 
     virtual void update() override;
     virtual void finalize() override;
 
     void setFinishTasksOnExit(bool b) { m_finishTasksOnExit = b; }
 
+    // a bounded alternative to finishing tasks on exit (it takes precedence over it)
+    // on finalize, immediate tasks and scheduled tasks which are due within the grace period are executed,
+    // until there are none left or until the deadline (both are measured from the start of finalize)
+    // scheduled tasks don't wait for their time, but are executed right away (in order)
+    // tasks which are still pending at the deadline are dropped (a task which is executing is not interrupted)
+    // only call before the executor is finalized
+    void setDrainOnExit(ms_t gracePeriod, ms_t deadline);
+
+    struct DrainReport {
+        size_t numExecuted = 0;
+        size_t numDropped = 0; // including the scheduled tasks which were not due within the grace period
+        clock_t::duration duration{};
+        bool deadlineReached = false;
+    };
+    // valid after the executor has been finalized with drain on exit
+    const DrainReport& drainReport() const { return m_drainReport; }
+
+    // timer slack
+    // while minTimeToSchedule allows scheduled tasks to be executed a bit early, the slack allows them to be late:
+    // the wake up for a scheduled task is delayed to the next multiple of the slack,
+    // so all tasks which are due within the same window of the slack are executed on a single wake up
+    // a slack of 0 (the default) means precise wake ups
+    // valid on any thread (affects wake ups scheduled after the call)
+    void setTimerSlack(ms_t slack);
+
+    // statistics of the scheduled tasks
+    // the number of timed tasks per timer fire shows how many wake ups were saved by coalescing
+    struct TimerStats {
+        uint64_t numTimerFires = 0; // updates in which scheduled tasks were due
+        uint64_t numTimedTasks = 0; // scheduled tasks which were executed
+    };
+    // valid on any thread, but only informative
+    TimerStats timerStats() const;
+
     // tasks
     // tasks are pushed from various threads
     // tasks are executed on update
@@ -32,7 +78,53 @@ public:
     using task_id = uint32_t;
     using task_ctoken = uint32_t; // cancellation token
 
+    // returned by push functions when the task was rejected (see OverflowPolicy)
+    static constexpr task_id invalid_task_id = task_id(-1);
+
+    // queue capacity
+    // by default the task queue is unbounded
+    // when a capacity is set, the overflow policy determines what happens when a task is pushed to a full queue
+    // the capacity only applies to the queue of immediate tasks (scheduled tasks are added to it when they're due)
+    enum class OverflowPolicy {
+        // the producer is blocked until the executor makes room (WARNING: never push to a full queue from the executor's thread)
+        // while blocked, the tasks are unlocked (see TaskLocker)
+        Block,
+        Reject, // the new task is discarded and invalid_task_id is returned
+        DropOldest, // the oldest pending task is discarded to make room for the new one
+        Coalesce, // pending tasks with the same token as the new one are discarded to make room, if there are none, the new task is rejected
+    };
+
+    // a capacity of 0 means unbounded
+    // valid on any thread
+    void setCapacity(size_t capacity, OverflowPolicy policy);
+
+    // number of tasks waiting in the queue of immediate tasks
+    // valid on any thread, but doesn't lock so the value may be slightly stale
+    // useful for producers which want to shed load before the queue is full
+    size_t queueDepth() const { return m_queueDepth.load(std::memory_order_relaxed); }
+
+    // memory
+    // by default the task containers keep their peak capacity, so a burst of tasks doesn't lead to allocations
+    // the next time. With a shrink policy, the high-water marks of the queue and of the scheduled tasks are
+    // tracked over a sliding window (of one to two window lengths) and containers which reserve more than
+    // factor times the mark are shrunk to it. The check is made on update, once per window
+    // while the containers reserve more than that for the tasks they hold, the executor schedules a wake up for the
+    // next check, so an executor which goes idle after a burst still shrinks
+    // a zero window (the default) means no shrinking
+    // valid on any thread
+    void setShrinkPolicy(ms_t window, size_t factor = 4);
+
+    // bytes reserved by the task queues and the scheduled tasks (including the staged ones) as of the last update
+    // (excluding the token maps and the captures of tasks which don't fit in the task object)
+    // valid on any thread, but only informative
+    size_t reservedBytes() const { return m_reservedBytes.load(std::memory_order_relaxed); }
+
     // locker raii interface
+    // WARNING: with the Block overflow policy, pushTask releases the lock while it waits for room in the queue
+    // thus a batch of operations under a locker is only atomic up to the first push which blocks:
+    // other producers may push or cancel tasks in the meantime (including pushing tasks with a token which
+    // the batch has just cancelled) and the executor may execute tasks which were pushed earlier in the batch
+    // use tryPushTask in batches which must be atomic
     class TaskLocker {
     public:
         explicit TaskLocker(TaskExecutor* e) : m_executor(e) {
@@ -47,11 +139,17 @@ public:
         ~TaskLocker() {
             if (m_executor) m_executor->unlockTasks();
         }
-        task_id pushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0) {
-            return m_executor->pushTaskL(std::move(task), ownToken, tasksToCancelToken);
+        task_id pushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current()) {
+            return m_executor->pushTaskL(std::move(task), ownToken, tasksToCancelToken, site);
         }
-        task_id scheduleTask(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0) {
-            return m_executor->scheduleTaskL(timeFromNow, std::move(task), ownToken, tasksToCancelToken);
+        task_id tryPushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current()) {
+            return m_executor->tryPushTaskL(std::move(task), ownToken, tasksToCancelToken, site);
+        }
+        task_id pushOrReplaceTask(Task task, task_ctoken key, TaskSite site = TaskSite::current()) {
+            return m_executor->pushOrReplaceTaskL(std::move(task), key, site);
+        }
+        task_id scheduleTask(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current()) {
+            return m_executor->scheduleTaskL(timeFromNow, std::move(task), ownToken, tasksToCancelToken, site);
         }
         bool rescheduleTask(ms_t timeFromNow, task_id id) {
             return m_executor->rescheduleTaskL(timeFromNow, id);
@@ -61,26 +159,54 @@ public:
     };
     TaskLocker taskLocker() { return TaskLocker(this); }
 
-    task_id pushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0) {
-        return taskLocker().pushTask(std::move(task), ownToken, tasksToCancelToken);
+    // the last argument of the push and schedule functions is the submission site used by task profiling
+    // (see TaskProfiling.hpp) it defaults to the call site, so there is usually no need to provide it
+    task_id pushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current()) {
+        return taskLocker().pushTask(std::move(task), ownToken, tasksToCancelToken, site);
+    }
+
+    // same as pushTask, but never blocks
+    // if the queue is full and the overflow policy can't make room, the task is discarded and invalid_task_id is returned
+    task_id tryPushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current()) {
+        return taskLocker().tryPushTask(std::move(task), ownToken, tasksToCancelToken, site);
     }
 
-    task_id scheduleTask(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0) {
-        return taskLocker().scheduleTask(timeFromNow, std::move(task), ownToken, tasksToCancelToken);
+    // push a task with a key (which is also its cancellation token)
+    // if a task with the same key is already pending in the queue, it's replaced by the new one in place:
+    // the new task takes the old one's place in the queue and its id, which is returned
+    // this is an O(1) operation, suitable for tasks like "refresh X", where only the latest one matters
+    // (unlike pushing with tasksToCancelToken, this reuses the old task's place and doesn't grow the queue)
+    // NOTE that only the queue of immediate tasks is checked. Scheduled tasks with the same key are not affected
+    // a replacement counts as an enqueue of the task with the given site (for profiling and hooks)
+    task_id pushOrReplaceTask(Task task, task_ctoken key, TaskSite site = TaskSite::current()) {
+        return taskLocker().pushOrReplaceTask(std::move(task), key, site);
     }
 
+    // unless it cancels tasks (or is too soon to be scheduled), this doesn't lock the tasks
+    // instead the task is staged and moved to the scheduled ones by the next update (or locked function)
+    // the executor is only woken up if the task is due before all others
+    // staging doesn't allocate either: it reuses the nodes of tasks which have been merged. When there are no free ones
+    // (say on the first call or in a burst) the tasks are locked and more nodes are allocated
+    task_id scheduleTask(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current());
+
     bool rescheduleTask(ms_t timeFromNow, task_id id) {
         return taskLocker().rescheduleTask(timeFromNow, id);
     }
 
+    // buffered pushing of many tasks from a single producer (see below)
+    class SubmissionBuffer;
+    SubmissionBuffer submissionBuffer(size_t flushThreshold = 64);
+
     // task locking
     // you need to lock the tasks with these functions or a locker before adding tasks
     void lockTasks();
     void unlockTasks();
 
     // only valid on any thread when tasks are locked
-    task_id pushTaskL(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0);
-    task_id scheduleTaskL(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0);
+    task_id pushTaskL(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current());
+    task_id tryPushTaskL(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current());
+    task_id pushOrReplaceTaskL(Task task, task_ctoken key, TaskSite site = TaskSite::current());
+    task_id scheduleTaskL(ms_t timeFromNow, Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current());
 
     // cancel the task successfully and return true if the task queue containing the task hasn't started executing.
     // return whether the task was removed from the pending tasks
@@ -97,53 +223,255 @@ public:
     bool rescheduleTaskL(ms_t timeFromNow, task_id id);
 
     // cancel tasks which were added with a given token and return the number successfully cancelled
+    // tasks are indexed by token, so the cost is proportional to the number of tasks with the token and not to all pending tasks
     // WARNING: tasks which are currently executing won't be cancelled; the number of such tasks may be more than one!
     size_t cancelTasksWithToken(task_ctoken token);
     size_t cancelTasksWithTokenL(task_ctoken token); // only valid on any thread when tasks are locked
 private:
     const ms_t m_minTimeToSchedule;
+    ms_t m_timerSlack = ms_t(0); // guarded by the tasks mutex
+
+    // only written in update, so they don't need the lock to be read
+    std::atomic<uint64_t> m_numTimerFires = 0;
+    std::atomic<uint64_t> m_numTimedTasks = 0;
 
     bool m_tasksLocked = false;  // a silly defence but should work most of the time
     bool m_finishTasksOnExit = false;
+
+    // drain on exit
+    bool m_drainOnExit = false;
+    ms_t m_drainGracePeriod = ms_t(0);
+    ms_t m_drainDeadline = ms_t(0);
+    DrainReport m_drainReport;
+    void drain();
     std::mutex m_tasksMutex;
 
-    task_id m_freeTaskId = 0;
-    task_id getNextTaskIdL();
+    // atomic, so ids can be given to tasks before they're queued (see SubmissionBuffer)
+    std::atomic<task_id> m_freeTaskId = 0;
+    task_id getNextTaskId();
+
+    // capacity
+    size_t m_capacity = 0;
+    OverflowPolicy m_overflowPolicy = OverflowPolicy::Block;
+    std::condition_variable m_queueHasRoomCV; // producers blocked on a full queue wait on this
+    size_t m_numBlockedProducers = 0;
+    std::atomic_size_t m_queueDepth = 0;
+    void updateQueueDepthL() { m_queueDepth.store(m_numQueuedTasks, std::memory_order_relaxed); }
+
+    // shrink policy
+    ms_t m_shrinkWindow = ms_t(0);
+    size_t m_shrinkFactor = 4;
+    clock_t::time_point m_shrinkWindowStart;
+    struct HighWaterMarks {
+        size_t queued = 0; // including tombstones
+        size_t timed = 0;
+        size_t staged = 0; // merged at once
+    };
+    HighWaterMarks m_highWaterMarks[2]; // of the current and of the previous window
+    void shrinkContainersL();
+    bool hasSurplusCapacityL() const; // whether the containers could shrink if no more tasks come
+
+    std::atomic_size_t m_reservedBytes = 0;
+    void updateReservedBytesL();
+
+    // return true if there is room for a new task in the queue
+    bool makeRoomL(task_ctoken ownToken, bool canBlock);
+    task_id doPushTaskL(Task task, task_ctoken ownToken, task_ctoken tasksToCancelToken, TaskSite site, bool canBlock);
 
     struct TaskWithId {
         Task task;
         task_id id;
         task_ctoken ctoken;
 
-        struct ById {
-            task_id id;
-            bool operator()(const TaskWithId& t) const { return t.id == id; }
-        };
-        struct ByCToken {
-            task_ctoken ctoken;
-            bool operator()(const TaskWithId& t) const { return t.ctoken == ctoken; }
-        };
+        // for profiling
+        TaskSite site;
+        clock_t::time_point enqueueTime; // null if pushed while profiling was disabled
+
+        bool profiled() const { return enqueueTime != clock_t::time_point{}; }
+    };
+
+    static constexpr uint32_t npos = uint32_t(-1);
+
+    // queued and timed tasks are stored as structures of arrays:
+    // the ids and tokens, which are scanned when tasks are cancelled, live in dense arrays,
+    // while the (much larger) callables live in parallel arrays
+    // the profiling data lives in yet another parallel array, which is only filled while there are tasks
+    // which were pushed with profiling enabled (or if the hooks need the sites, see Hooks.hpp)
+    // otherwise it's empty, so tasks don't carry the profiling data unless it's used
+    struct TaskProfile {
+        TaskSite site;
+        clock_t::time_point enqueueTime; // null if the task is not profiled
+    };
+
+    struct QueuedTaskMeta {
+        task_id id;
+        task_ctoken ctoken;
+
+        // index in the queue of the previous task with the same token (or npos)
+        // thus tasks with the same token form a chain, starting from the last one
+        uint32_t prevWithToken;
     };
-    std::vector<TaskWithId> m_taskQueue;
+
+    struct TaskQueue {
+        explicit TaskQueue(std::pmr::memory_resource* resource) : meta(resource), tasks(resource), profiles(resource) {}
+
+        std::pmr::vector<QueuedTaskMeta> meta;
+        std::pmr::vector<Task> tasks; // parallel to meta
+        std::pmr::vector<TaskProfile> profiles; // empty or parallel to meta
+
+        size_t size() const { return meta.size(); }
+        bool empty() const { return meta.empty(); }
+        void push(TaskWithId task, uint32_t prevWithToken);
+        TaskProfile& profile(uint32_t index); // fills the profiles if they're empty
+        TaskProfile profileAt(uint32_t index) const { return index < profiles.size() ? profiles[index] : TaskProfile{}; }
+        void shrink(size_t capacity);
+        size_t capacity() const { return meta.capacity(); }
+        size_t reservedBytes() const {
+            return meta.capacity() * sizeof(QueuedTaskMeta) + tasks.capacity() * sizeof(Task)
+                + profiles.capacity() * sizeof(TaskProfile);
+        }
+        void swap(TaskQueue& other) {
+            meta.swap(other.meta);
+            tasks.swap(other.tasks);
+            profiles.swap(other.profiles);
+        }
+        void clear() {
+            meta.clear();
+            tasks.clear();
+            profiles.clear();
+        }
+    };
+
+    std::pmr::memory_resource* const m_resource; // of the containers and the nodes of staged tasks
+
+    // tasks are not erased from the queue when they're cancelled
+    // instead they're turned into tombstones: their id becomes invalid_task_id and the task is reset
+    // thus cancelling a task is O(1) once it's found
+    // when the tombstones outnumber the live tasks, the queue is compacted on the next push,
+    // so its size stays proportional to the number of live tasks even if the executor isn't updated
+    // (indices in the queue are only stable between pushes)
+    TaskQueue m_taskQueue;
+    size_t m_numQueuedTasks = 0; // not counting tombstones
+    size_t m_oldestQueuedTask = 0; // there are only tombstones before this index
+
+    // token -> index in m_taskQueue of the last pushed task with this token (start of the chain)
+    std::pmr::unordered_map<task_ctoken, uint32_t> m_queuedTasksByToken;
+
+    void appendToQueueL(TaskWithId task);
+    void compactQueueL(); // erase the tombstones and relink the token chains
+    void cancelQueuedTaskL(uint32_t index);
+    size_t cancelQueuedTasksWithTokenL(task_ctoken token);
+    uint32_t findLastQueuedTaskWithTokenL(task_ctoken token); // npos if none
 
     // the access to this vector are strictly ordered
     // it's only touched in update and finalize
     // it's serves as a double-buffer for tasks from the queue
     // it's purpose is to save allocations for adding new tasks
     // instead, eventually this vector and the tasks queue vector will reach a peak capacity
-    // and new tasks won't lead to allocations
-    std::vector<TaskWithId> m_executingTasks;
+    // and new tasks won't lead to allocations (unless a shrink policy is set)
+    TaskQueue m_executingTasks;
     void fillExecutingTasksL();
+    void executeTask(const QueuedTaskMeta& meta, Task& task, const TaskProfile& profile);
     void executeTasks();
 
-    struct TimedTaskWithId : public TaskWithId {
+    struct TimedTaskMeta {
+        task_id id;
+        task_ctoken ctoken;
+
+        // slots of the neighboring tasks with the same token
+        // thus tasks with the same token form a doubly-linked list, so any one can be unlinked in O(1)
+        uint32_t prevWithToken;
+        uint32_t nextWithToken;
+    };
+
+    IndexedTimedQueue<TimedTaskMeta> m_timedTasks;
+    using timed_slot = IndexedTimedQueue<TimedTaskMeta>::slot_t;
+    std::pmr::vector<Task> m_timedTaskBodies; // by slot of m_timedTasks
+    std::pmr::vector<TaskProfile> m_timedTaskProfiles; // by slot of m_timedTasks, or empty (like the profiles of TaskQueue)
+
+    // token -> slot of a timed task with this token (head of the list)
+    std::pmr::unordered_map<task_ctoken, timed_slot> m_timedTasksByToken;
+
+    void addTimedTaskL(clock_t::time_point time, TaskWithId task);
+    TaskWithId extractTimedTaskL(timed_slot slot);
+
+    // scheduled tasks which are pushed without locking
+    // a lock-free stack, merged into m_timedTasks by whoever holds the lock next
+    struct StagedTimedTask {
+        TaskWithId task;
         clock_t::time_point time;
+        StagedTimedTask* next = nullptr; // in the stack of staged tasks
+
+        // in the free list
+        // atomic, as a producer which loses the race for a node may read it while the winner is using the node
+        std::atomic<uint32_t> nextFree = npos;
+        uint32_t index = 0;
     };
+    std::atomic<StagedTimedTask*> m_stagedTimedTasks = nullptr;
+    void mergeStagedTimedTasksL();
+    void clearStagedTimedTasks();
 
-    // adapt more so we can erase tasks
-    TimedQueue<TimedTaskWithId> m_timedTasks;
+    // the nodes of staged tasks are recycled through a lock-free free list, so staging doesn't allocate
+    // they're allocated from the memory resource under the lock, in chunks which double in size and are never moved.
+    // Thus they can be addressed by index, and the head of the free list is an index with an ABA tag in a single word
+    // with a shrink policy, trailing chunks whose nodes are all free are released (see shrinkStagedTasksL)
+    static constexpr uint32_t FirstStagedChunkSize = 16;
+    static constexpr uint32_t MaxStagedChunks = 20;
+    static uint32_t stagedChunkSize(uint32_t chunk) { return FirstStagedChunkSize << chunk; }
+    static uint32_t stagedChunkBegin(uint32_t chunk) { return FirstStagedChunkSize * ((uint32_t(1) << chunk) - 1); }
+    StagedTimedTask* m_stagedChunks[MaxStagedChunks] = {};
+    uint32_t m_numStagedChunks = 0; // guarded by the tasks mutex
+    std::atomic<uint64_t> m_freeStagedTasks = npos; // tag in the high 32 bits, index of the head (or npos) in the low ones
+    std::atomic<uint32_t> m_numPoppingProducers = 0; // so chunks aren't released while a producer reads their nodes
+    StagedTimedTask& stagedTask(uint32_t index);
+    StagedTimedTask* popFreeStagedTask(); // null if there are no free nodes
+    void pushFreeStagedTasks(StagedTimedTask& first, StagedTimedTask& last); // a chain linked by nextFree
+    void addStagedChunkL();
+    void shrinkStagedTasksL(size_t mark);
 
-    struct TaskHasCToken; // helper for searches by token
+    // the time of the earliest scheduled task (as time since epoch) or max if there are none
+    // producers of staged tasks wake the executor up only if they lower it
+    std::atomic<clock_t::rep> m_earliestTimedTask = std::numeric_limits<clock_t::rep>::max();
 };
 
+// Accumulates tasks for an executor and queues them in bulk: under a single lock and with a single wake up
+// Meant for a producer which pushes many small tasks in a tight loop
+// It's owned by the producer and is not thread safe (thus there is one per producer per executor)
+// Tasks are flushed when their number reaches the flush threshold, explicitly with flush(), and on destruction
+// Ids are given on push and the tasks of a buffer are queued in the order in which they were pushed
+// NOTE: a task can't be cancelled until it's flushed (cancelTask will return false for it)
+// NOTE: if the executor has a capacity, the overflow policy is applied on flush, as if the tasks were pushed with
+//       pushTask, so a flush may block (in which case it's not atomic, see TaskLocker), and if a task is rejected,
+//       it won't be executed, even though it has an id
+class TaskExecutor::SubmissionBuffer {
+public:
+    explicit SubmissionBuffer(TaskExecutor& executor, size_t flushThreshold = 64);
+    ~SubmissionBuffer();
+
+    SubmissionBuffer(const SubmissionBuffer&) = delete;
+    SubmissionBuffer& operator=(const SubmissionBuffer&) = delete;
+    SubmissionBuffer(SubmissionBuffer&& other) noexcept;
+    SubmissionBuffer& operator=(SubmissionBuffer&&) = delete;
+
+    task_id pushTask(Task task, task_ctoken ownToken = 0, task_ctoken tasksToCancelToken = 0, TaskSite site = TaskSite::current());
+
+    void flush();
+
+    size_t size() const { return m_tasks.size(); } // number of tasks waiting to be flushed
+
+private:
+    TaskExecutor* m_executor;
+    size_t m_flushThreshold;
+
+    struct BufferedTask {
+        TaskWithId task;
+        task_ctoken tasksToCancelToken;
+    };
+    std::vector<BufferedTask> m_tasks; // reused between flushes
+};
+
+inline TaskExecutor::SubmissionBuffer TaskExecutor::submissionBuffer(size_t flushThreshold) {
+    return SubmissionBuffer(*this, flushThreshold);
+}
+
 }
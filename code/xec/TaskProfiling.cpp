@@ -0,0 +1,127 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TaskProfiling.hpp"
+
+#include "bits/profile.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace xec::profile {
+
+std::atomic_bool g_enabled = false;
+
+namespace {
+
+struct SiteKey {
+    const char* file;
+    uint32_t line;
+    bool operator==(const SiteKey& other) const { return file == other.file && line == other.line; }
+};
+
+struct SiteKeyHash {
+    size_t operator()(const SiteKey& k) const {
+        return std::hash<const char*>{}(k.file) ^ (size_t(k.line) * 0x9E3779B97F4A7C15ull);
+    }
+};
+
+// the mutex is only contended when collecting or resetting
+struct ThreadTable {
+    std::mutex mutex;
+    std::unordered_map<SiteKey, SiteStats, SiteKeyHash> stats;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadTable>> tables;
+
+    static Registry& instance() {
+        static Registry r;
+        return r;
+    }
+
+    std::shared_ptr<ThreadTable> newTable() {
+        auto table = std::make_shared<ThreadTable>();
+        std::lock_guard<std::mutex> lk(mutex);
+        tables.push_back(table);
+        return table;
+    }
+
+    std::vector<std::shared_ptr<ThreadTable>> allTables() {
+        std::lock_guard<std::mutex> lk(mutex);
+        return tables;
+    }
+};
+
+ThreadTable& thisThreadTable() {
+    // shared so that the registry keeps it alive after the thread exits
+    thread_local std::shared_ptr<ThreadTable> table = Registry::instance().newTable();
+    return *table;
+}
+
+void merge(SiteStats& target, const SiteStats& source) {
+    target.count += source.count;
+    target.totalTime += source.totalTime;
+    target.maxTime = std::max(target.maxTime, source.maxTime);
+    target.totalQueueDelay += source.totalQueueDelay;
+    target.maxQueueDelay = std::max(target.maxQueueDelay, source.maxQueueDelay);
+}
+
+} // namespace
+
+void enable(bool on) {
+    g_enabled.store(on, std::memory_order_relaxed);
+}
+
+bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void reset() {
+    for (auto& table : Registry::instance().allTables()) {
+        std::lock_guard<std::mutex> lk(table->mutex);
+        table->stats.clear();
+    }
+}
+
+void record(const TaskSite& site, std::chrono::nanoseconds time, std::chrono::nanoseconds queueDelay) {
+    auto& table = thisThreadTable();
+    std::lock_guard<std::mutex> lk(table.mutex);
+    auto& stats = table.stats[{site.file, site.line}];
+    stats.site = site;
+    merge(stats, {site, 1, time, time, queueDelay, queueDelay});
+}
+
+std::vector<SiteStats> collect() {
+    // the same file may have different string addresses in different translation units (or modules)
+    // so merge by content
+    std::map<std::pair<std::string, uint32_t>, SiteStats> merged;
+
+    for (auto& table : Registry::instance().allTables()) {
+        std::lock_guard<std::mutex> lk(table->mutex);
+        for (auto& [key, stats] : table->stats) {
+            auto& m = merged[{key.file ? key.file : "", key.line}];
+            m.site = stats.site;
+            merge(m, stats);
+        }
+    }
+
+    std::vector<SiteStats> ret;
+    ret.reserve(merged.size());
+    for (auto& [key, stats] : merged) {
+        ret.push_back(stats);
+    }
+
+    std::sort(ret.begin(), ret.end(), [](const SiteStats& a, const SiteStats& b) {
+        return a.totalTime > b.totalTime;
+    });
+
+    return ret;
+}
+
+}
@@ -0,0 +1,68 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "API.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace xec {
+
+// the place from which a task was submitted
+// captured at the call site by the default arguments of the push and schedule functions of TaskExecutor
+// alternatively it can be a user tag, which must be a string with static storage (like a literal)
+struct TaskSite {
+    const char* file = nullptr; // or tag
+    uint32_t line = 0; // 0 for tags
+
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1926)
+    static constexpr TaskSite current(const char* file = __builtin_FILE(), uint32_t line = __builtin_LINE()) noexcept {
+        return {file, line};
+    }
+#else
+    // no way to capture the call site
+    static constexpr TaskSite current() noexcept { return {}; }
+#endif
+
+    static constexpr TaskSite tag(const char* name) noexcept { return {name, 0}; }
+};
+
+// Per call site profile of task execution
+//
+// When enabled, each executed task adds its execution time and queueing delay to the stats of its site
+// The queueing delay is the time from pushing the task to the start of its execution
+// (or, for scheduled tasks, from the time it was scheduled for to the start of its execution)
+//
+// Stats are accumulated in per-thread tables, so threads executing tasks don't contend with each other,
+// and are merged on demand
+// While disabled, the cost is a relaxed atomic load per pushed and per executed task
+// and queued tasks don't carry their site and enqueue time
+
+namespace profile {
+
+// safe to call from any thread at any time
+// only tasks which were pushed while profiling was enabled are profiled
+XEC_API void enable(bool on = true);
+XEC_API bool enabled();
+
+// discard all stats collected so far
+XEC_API void reset();
+
+struct SiteStats {
+    TaskSite site;
+    uint64_t count = 0;
+    std::chrono::nanoseconds totalTime{};
+    std::chrono::nanoseconds maxTime{};
+    std::chrono::nanoseconds totalQueueDelay{};
+    std::chrono::nanoseconds maxQueueDelay{};
+};
+
+// merged stats from all threads, sorted by total time, descending
+// safe to call while tasks are being executed
+XEC_API std::vector<SiteStats> collect();
+
+} // namespace profile
+
+}
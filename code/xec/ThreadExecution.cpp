@@ -4,10 +4,8 @@
 #include "ThreadExecution.hpp"
 
 #include "ExecutorBase.hpp"
-#include "ThreadName.hpp"
 
-#include <cassert>
-#include <functional>
+#include "bits/update.hpp"
 
 namespace xec {
 
@@ -93,11 +91,7 @@ LocalExecution::LocalExecution(ExecutorBase& e)
 }
 
 void LocalExecution::run() {
-    while (m_context->running()) {
-        m_context->wait();
-        m_executor.update();
-    }
-    m_executor.finalize();
+    runExecutionLoop(*m_context, m_executor);
 }
 
 ThreadExecution::ThreadExecution(ExecutorBase& e)
@@ -109,17 +103,11 @@ ThreadExecution::~ThreadExecution() {
 }
 
 void ThreadExecution::launchThread(std::optional<std::string_view> threadName) {
-    assert(!m_thread.joinable()); // we have an active thread???
-    m_thread = std::thread(std::bind(&ThreadExecution::thread, this));
-    if (threadName) {
-        SetThreadName(m_thread, *threadName);
-    }
+    m_thread.launch([this] { LocalExecution::run(); }, threadName);
 }
 
 void ThreadExecution::joinThread() {
-    if (m_thread.joinable()) {
-        m_thread.join();
-    }
+    m_thread.join();
 }
 
 void ThreadExecution::stopAndJoinThread() {
@@ -127,8 +115,4 @@ void ThreadExecution::stopAndJoinThread() {
     joinThread();
 }
 
-void ThreadExecution::thread() {
-    LocalExecution::run();
-}
-
 }
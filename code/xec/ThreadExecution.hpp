@@ -3,6 +3,7 @@
 //
 #pragma once
 #include "ExecutionContext.hpp"
+#include "bits/ExecutionThread.hpp"
 
 #include <mutex>
 #include <atomic>
@@ -66,11 +67,9 @@ public:
     void joinThread(); // Wait for thread to join. WARNING: unless someone stops the execution, this will wait indefinitely!
     void stopAndJoinThread(); // Stop the execution and wait for join
 
-    std::thread::id threadId() const { return m_thread.get_id(); }
+    std::thread::id threadId() const { return m_thread.id(); }
 private:
-    std::thread m_thread;
-    // NOT MAIN THREAD
-    void thread();
+    ExecutionThread m_thread;
 };
 
 }
@@ -0,0 +1,277 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "Tracing.hpp"
+#include "ThreadName.hpp"
+
+#include "bits/trace.hpp"
+#include "bits/chrono.hpp"
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdio>
+
+namespace xec::trace {
+
+std::atomic_bool g_enabled = false;
+
+namespace {
+
+// the fields are relaxed atomics, so that the dump can read them while a thread is recording
+// torn events are detected by the claimed counter of the buffer
+struct Slot {
+    std::atomic_uint64_t time; // ns
+    std::atomic_uint64_t object;
+    std::atomic_uint64_t a;
+    std::atomic_uint64_t b;
+    std::atomic_uint8_t type;
+};
+
+struct ThreadBuffer {
+    ThreadBuffer(uint32_t t, size_t capacity)
+        : tid(t)
+        , name(GetThisThreadName())
+        , mask(capacity - 1)
+        , slots(new Slot[capacity])
+    {}
+
+    const uint32_t tid;
+    const std::string name;
+    const uint64_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    // number of events which have started recording
+    // incremented before a slot is written
+    std::atomic_uint64_t claimed = 0;
+
+    // number of events which have been fully recorded
+    std::atomic_uint64_t committed = 0;
+
+    // events before this have been cleared
+    std::atomic_uint64_t begin = 0;
+
+    // only called by the owning thread
+    void record(EventType type, const void* object, uint64_t a, uint64_t b) {
+        const auto i = claimed.load(std::memory_order_relaxed);
+        claimed.store(i + 1, std::memory_order_relaxed);
+
+        // if the dump sees any of the writes below, it will also see the claim above
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto& slot = slots[i & mask];
+        slot.time.store(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_t::now().time_since_epoch()).count()), std::memory_order_relaxed);
+        slot.object.store(uint64_t(uintptr_t(object)), std::memory_order_relaxed);
+        slot.a.store(a, std::memory_order_relaxed);
+        slot.b.store(b, std::memory_order_relaxed);
+        slot.type.store(uint8_t(type), std::memory_order_relaxed);
+
+        committed.store(i + 1, std::memory_order_release);
+    }
+};
+
+struct Event {
+    uint64_t time;
+    uint64_t object;
+    uint64_t a;
+    uint64_t b;
+    EventType type;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    size_t capacity = 1 << 14;
+
+    static Registry& instance() {
+        static Registry r;
+        return r;
+    }
+
+    std::shared_ptr<ThreadBuffer> newBuffer() {
+        std::lock_guard<std::mutex> lk(mutex);
+        auto buf = std::make_shared<ThreadBuffer>(uint32_t(buffers.size() + 1), capacity);
+        buffers.push_back(buf);
+        return buf;
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> allBuffers() {
+        std::lock_guard<std::mutex> lk(mutex);
+        return buffers;
+    }
+};
+
+ThreadBuffer& thisThreadBuffer() {
+    // shared so that the registry keeps it alive after the thread exits
+    thread_local std::shared_ptr<ThreadBuffer> buf = Registry::instance().newBuffer();
+    return *buf;
+}
+
+// copy all the valid events of a buffer
+void collect(const ThreadBuffer& buf, std::vector<Event>& out) {
+    const auto capacity = buf.mask + 1;
+
+    const auto end = buf.committed.load(std::memory_order_acquire);
+    auto begin = std::max(buf.begin.load(std::memory_order_relaxed), end > capacity ? end - capacity : 0);
+
+    const auto first = out.size();
+    for (auto i = begin; i < end; ++i) {
+        auto& slot = buf.slots[i & buf.mask];
+        auto& e = out.emplace_back();
+        e.time = slot.time.load(std::memory_order_relaxed);
+        e.object = slot.object.load(std::memory_order_relaxed);
+        e.a = slot.a.load(std::memory_order_relaxed);
+        e.b = slot.b.load(std::memory_order_relaxed);
+        e.type = EventType(slot.type.load(std::memory_order_relaxed));
+    }
+
+    // events which have been claimed in the meantime may have overwritten some of the ones we copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto claimed = buf.claimed.load(std::memory_order_relaxed);
+    if (claimed > begin + capacity) {
+        const auto numOverwritten = std::min(claimed - capacity, end) - begin;
+        out.erase(out.begin() + ptrdiff_t(first), out.begin() + ptrdiff_t(first + numOverwritten));
+    }
+}
+
+void writeJsonString(std::ostream& out, const std::string& str) {
+    out << '"';
+    for (auto c : str) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (uint8_t(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+void writePtr(std::ostream& out, uint64_t ptr) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "\"0x%llx\"", (unsigned long long)ptr);
+    out << buf;
+}
+
+void writeTimestamp(std::ostream& out, uint64_t ns) {
+    // chrome trace timestamps are in microseconds
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000), unsigned(ns % 1000));
+    out << buf;
+}
+
+} // namespace
+
+bool supported() {
+#if XEC_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void enable(bool on) {
+    g_enabled.store(on, std::memory_order_relaxed);
+}
+
+bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void setBufferCapacity(size_t numEvents) {
+    size_t capacity = 1;
+    while (capacity < numEvents) capacity <<= 1;
+
+    auto& r = Registry::instance();
+    std::lock_guard<std::mutex> lk(r.mutex);
+    r.capacity = capacity;
+}
+
+void clear() {
+    for (auto& buf : Registry::instance().allBuffers()) {
+        buf->begin.store(buf->committed.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+void record(EventType type, const void* object, uint64_t a, uint64_t b) {
+    thisThreadBuffer().record(type, object, a, b);
+}
+
+void writeChromeTrace(std::ostream& out) {
+    auto buffers = Registry::instance().allBuffers();
+
+    out << "{\"traceEvents\":[";
+
+    bool first = true;
+    auto next = [&]() -> std::ostream& {
+        if (!first) out << ",";
+        first = false;
+        out << "\n";
+        return out;
+    };
+
+    std::vector<Event> events;
+    for (auto& buf : buffers) {
+        next() << R"({"ph":"M","pid":1,"tid":)" << buf->tid << R"(,"name":"thread_name","args":{"name":)";
+        writeJsonString(out, buf->name.empty() ? "thread " + std::to_string(buf->tid) : buf->name);
+        out << "}}";
+
+        events.clear();
+        collect(*buf, events);
+
+        for (auto& e : events) {
+            const char* ph = "i";
+            const char* name = "";
+            switch (e.type) {
+            case EventType::UpdateBegin: ph = "B"; name = "update"; break;
+            case EventType::UpdateEnd: ph = "E"; name = "update"; break;
+            case EventType::TaskBegin: ph = "B"; name = "task"; break;
+            case EventType::TaskEnd: ph = "E"; name = "task"; break;
+            case EventType::WakeUpNow: name = "wakeUpNow"; break;
+            case EventType::ScheduleWakeUp: name = "scheduleNextWakeUp"; break;
+            case EventType::DispatchContext: name = "dispatch"; break;
+            case EventType::DispatchStrand: name = "dispatch strand"; break;
+            }
+
+            next() << R"({"ph":")" << ph << R"(","pid":1,"tid":)" << buf->tid << R"(,"name":")" << name << R"(","ts":)";
+            writeTimestamp(out, e.time);
+            if (*ph == 'i') {
+                out << R"(,"s":"t")"; // thread scoped instant event
+            }
+
+            out << R"(,"args":{)";
+            switch (e.type) {
+            case EventType::UpdateBegin:
+            case EventType::WakeUpNow:
+            case EventType::DispatchContext:
+                out << R"("executor":)";
+                writePtr(out, e.object);
+                break;
+            case EventType::TaskBegin:
+                out << R"("executor":)";
+                writePtr(out, e.object);
+                out << R"(,"id":)" << e.a << R"(,"ctoken":)" << e.b;
+                break;
+            case EventType::ScheduleWakeUp:
+                out << R"("executor":)";
+                writePtr(out, e.object);
+                out << R"(,"ms":)" << e.a;
+                break;
+            case EventType::DispatchStrand:
+                out << R"("strand":)";
+                writePtr(out, e.object);
+                break;
+            default:
+                // args of end events are merged with the begin ones
+                break;
+            }
+            out << "}}";
+        }
+    }
+
+    out << "\n]}\n";
+}
+
+}
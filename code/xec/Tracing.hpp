@@ -0,0 +1,51 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "API.h"
+
+#include <cstddef>
+#include <iosfwd>
+
+// Optional tracing of executor activity
+//
+// Recorded events:
+// * update begin/end of each executor (from the execution loops)
+// * execution span of each task of a TaskExecutor with its id and cancellation token
+// * wake up requests (wakeUpNow and scheduleNextWakeUp)
+// * dispatch decisions of PoolExecution workers (which executor or strand they picked up)
+//
+// Trace points are compiled in only if the library is built with XEC_TRACING (cmake option XEC_TRACING)
+// Even then, nothing is recorded until tracing is enabled at runtime
+// While disabled, the cost of a trace point is a relaxed atomic load and a branch
+//
+// Events are recorded in per-thread lock-free ring buffers. When a buffer is full the oldest events are overwritten
+// Buffers are allocated on the first recorded event of a thread and are kept alive after the thread exits,
+// so the dump also contains the events of finished threads
+
+namespace xec::trace {
+
+// true if the library has been built with trace points
+XEC_API bool supported();
+
+// safe to call from any thread at any time
+// NOTE: spans which are open when tracing is toggled are not closed (or opened), so only one of their ends is recorded
+//       and a dump may contain unmatched begin or end events (trace viewers show them as unfinished spans)
+//       for balanced traces, toggle while the traced executors are idle or stopped
+XEC_API void enable(bool on = true);
+XEC_API bool enabled();
+
+// capacity (number of events) of buffers which are allocated after this call
+// rounded up to a power of two
+XEC_API void setBufferCapacity(size_t numEvents);
+
+// discard all events recorded so far
+XEC_API void clear();
+
+// dump all recorded events in Chrome trace JSON format
+// (load in chrome://tracing or https://ui.perfetto.dev)
+// safe to call while events are being recorded
+// events which are overwritten while dumping are skipped
+XEC_API void writeChromeTrace(std::ostream& out);
+
+}
@@ -0,0 +1,145 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "Watchdog.hpp"
+#include "ExecutorBase.hpp"
+#include "PoolExecution.hpp"
+#include "ThreadName.hpp"
+
+#include <algorithm>
+
+namespace xec {
+
+Watchdog::Watchdog(ms_t threshold, StallHandler handler, std::optional<ms_t> checkInterval)
+    : m_threshold(threshold)
+    , m_checkInterval(checkInterval ? *checkInterval : std::max(threshold / 4, ms_t(1)))
+    , m_handler(std::move(handler))
+{
+    m_thread = std::thread([this] {
+        SetThisThreadName("xec watchdog");
+        thread();
+    });
+}
+
+Watchdog::~Watchdog() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+
+    for (auto& w : m_executors) {
+        w.executor->setHeartbeat(nullptr);
+    }
+}
+
+void Watchdog::watch(ExecutorBase& executor) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto& w : m_executors) {
+        if (w.executor == &executor) return; // already watched
+    }
+    auto& w = m_executors.emplace_back();
+    w.executor = &executor;
+    w.heartbeat = std::make_unique<Heartbeat>();
+    executor.setHeartbeat(w.heartbeat.get());
+}
+
+void Watchdog::unwatch(ExecutorBase& executor) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_reportDoneCV.wait(lock, [this] { return !m_reporting; });
+    auto f = std::find_if(m_executors.begin(), m_executors.end(), [&](const WatchedExecutor& w) {
+        return w.executor == &executor;
+    });
+    if (f == m_executors.end()) return;
+    executor.setHeartbeat(nullptr);
+    m_retiredHeartbeats.push_back(std::move(f->heartbeat));
+    m_executors.erase(f);
+}
+
+void Watchdog::watch(PoolExecution& pool) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto& w : m_pools) {
+        if (w.pool == &pool) return; // already watched
+    }
+    m_pools.push_back({&pool, {}});
+}
+
+void Watchdog::unwatch(PoolExecution& pool) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_pools.erase(std::remove_if(m_pools.begin(), m_pools.end(), [&](const WatchedPool& w) {
+        return w.pool == &pool;
+    }), m_pools.end());
+}
+
+Watchdog::PoolStats Watchdog::poolStats(const PoolExecution& pool) const {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto& w : m_pools) {
+        if (w.pool == &pool) return w.stats;
+    }
+    return {};
+}
+
+void Watchdog::checkL(std::vector<Stall>& stalls) {
+    const auto now = Heartbeat::now();
+    const auto threshold = std::chrono::duration_cast<std::chrono::nanoseconds>(m_threshold).count();
+    auto elapsed = [&](int64_t start) {
+        return std::chrono::duration_cast<ms_t>(std::chrono::nanoseconds(now - start));
+    };
+
+    for (auto& w : m_executors) {
+        Heartbeat::Snapshot s;
+        if (!w.heartbeat->read(s)) continue; // made progress while we were reading
+
+        if (s.taskStart) {
+            if (now - s.taskStart > threshold && s.taskStart != w.lastReportedTask) {
+                w.lastReportedTask = s.taskStart;
+                // the update is stalled because of this task, so don't report it separately
+                w.lastReportedUpdate = s.updateStart;
+                stalls.push_back({*w.executor, true, s.taskId, s.taskCToken, elapsed(s.taskStart)});
+            }
+        }
+        else if (s.updateStart) {
+            if (now - s.updateStart > threshold && s.updateStart != w.lastReportedUpdate) {
+                w.lastReportedUpdate = s.updateStart;
+                stalls.push_back({*w.executor, false, 0, 0, elapsed(s.updateStart)});
+            }
+        }
+    }
+
+    for (auto& w : m_pools) {
+        const auto numWorkers = w.pool->numWorkers();
+        const auto numBusy = w.pool->numBusyWorkers();
+        ++w.stats.numSamples;
+        if (numWorkers && numBusy >= numWorkers) {
+            ++w.stats.numAllBusySamples;
+        }
+        w.stats.maxBusyWorkers = std::max(w.stats.maxBusyWorkers, numBusy);
+    }
+}
+
+void Watchdog::thread() {
+    std::vector<Stall> stalls;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait_for(lock, m_checkInterval, [this] { return !m_running; });
+        if (!m_running) return;
+
+        checkL(stalls);
+        if (stalls.empty()) continue;
+
+        // don't hold the lock while reporting, so the handler can't block the watch functions
+        // (except for unwatching executors, which must wait for the stalls referring to them to be reported)
+        m_reporting = true;
+        lock.unlock();
+        for (auto& s : stalls) {
+            m_handler(s);
+        }
+        stalls.clear();
+        lock.lock();
+        m_reporting = false;
+        m_reportDoneCV.notify_all();
+    }
+}
+
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "API.h"
+#include "Heartbeat.hpp"
+
+#include <itlib/ufunction.hpp>
+
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <condition_variable>
+
+namespace xec {
+class ExecutorBase;
+class PoolExecution;
+
+// A thread which periodically checks the heartbeats of watched executors and reports stalls:
+// tasks or updates which have been running for longer than a threshold
+// It also samples the busy workers of watched pools, to help with sizing them
+class XEC_API Watchdog {
+public:
+    struct Stall {
+        ExecutorBase& executor;
+        bool inTask; // false if the update is stalled outside of a task (or the executor doesn't mark tasks)
+        uint32_t taskId; // TaskExecutor::task_id of the stalled task (only if inTask)
+        uint32_t taskCToken; // its cancellation token
+        ms_t elapsed;
+    };
+    using StallHandler = itlib::ufunction<void(const Stall&)>;
+
+    // the handler is called on the watchdog thread once per stalled task or update
+    // the check interval defaults to a quarter of the threshold
+    Watchdog(ms_t threshold, StallHandler handler, std::optional<ms_t> checkInterval = {});
+    ~Watchdog();
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // all functions are valid on any thread, but the watchdog one (so not from the handler)
+
+    // unwatching an executor waits for the report in progress (if any), as it may be about this executor
+    // so it's safe to destroy the executor once unwatch returns
+    // WARNING: executors must be unwatched before they are destroyed
+    void watch(ExecutorBase& executor);
+    void unwatch(ExecutorBase& executor);
+
+    // WARNING: pools must be unwatched before they are destroyed
+    void watch(PoolExecution& pool);
+    void unwatch(PoolExecution& pool);
+
+    struct PoolStats {
+        uint64_t numSamples = 0;
+        uint64_t numAllBusySamples = 0; // samples in which all workers were busy
+        size_t maxBusyWorkers = 0;
+    };
+    // return empty stats if the pool isn't watched
+    PoolStats poolStats(const PoolExecution& pool) const;
+
+private:
+    const ms_t m_threshold;
+    const ms_t m_checkInterval;
+    StallHandler m_handler;
+
+    struct WatchedExecutor {
+        ExecutorBase* executor;
+        std::unique_ptr<Heartbeat> heartbeat;
+
+        // start times of the last reported stalls, so we report each one once
+        int64_t lastReportedUpdate = 0;
+        int64_t lastReportedTask = 0;
+    };
+    std::vector<WatchedExecutor> m_executors;
+
+    // the executor may still be using the heartbeat of an unwatched executor,
+    // so we keep it alive until the watchdog is destroyed
+    std::vector<std::unique_ptr<Heartbeat>> m_retiredHeartbeats;
+
+    struct WatchedPool {
+        const PoolExecution* pool;
+        PoolStats stats;
+    };
+    std::vector<WatchedPool> m_pools;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running = true;
+
+    // the handler is called without the lock, so this is set while it's being called
+    bool m_reporting = false;
+    std::condition_variable m_reportDoneCV;
+    std::thread m_thread;
+
+    void thread();
+    void checkL(std::vector<Stall>& stalls);
+};
+
+}
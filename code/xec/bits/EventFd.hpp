@@ -0,0 +1,44 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cerrno>
+#include <system_error>
+
+namespace xec {
+
+// linux only
+// a non-blocking eventfd used to wake up threads which wait on file descriptors
+class EventFd {
+public:
+    EventFd()
+        : m_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if (m_fd < 0) throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+    ~EventFd() { close(m_fd); }
+
+    EventFd(const EventFd&) = delete;
+    EventFd& operator=(const EventFd&) = delete;
+
+    int fd() const { return m_fd; }
+
+    // make the fd readable
+    void signal() {
+        uint64_t one = 1;
+        [[maybe_unused]] auto r = write(m_fd, &one, sizeof(one));
+    }
+
+    // make the fd non-readable again
+    void drain() {
+        uint64_t value;
+        [[maybe_unused]] auto r = read(m_fd, &value, sizeof(value));
+    }
+private:
+    int m_fd;
+};
+
+} // namespace xec
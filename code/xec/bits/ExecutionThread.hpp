@@ -0,0 +1,44 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "../ThreadName.hpp"
+
+#include <thread>
+#include <optional>
+#include <string_view>
+#include <string>
+#include <cassert>
+
+namespace xec {
+
+// the thread of an execution which runs the loop of a single executor (ThreadExecution, EpollExecution)
+class ExecutionThread {
+public:
+    template <typename F>
+    void launch(F&& run, std::optional<std::string_view> threadName) {
+        assert(!m_thread.joinable()); // we have an active thread???
+        if (threadName) {
+            // name the thread before it runs, so the name is seen by everything it records (like traces)
+            m_thread = std::thread([run = std::forward<F>(run), name = std::string(*threadName)]() mutable {
+                SetThisThreadName(name);
+                run();
+            });
+        }
+        else {
+            m_thread = std::thread(std::forward<F>(run));
+        }
+    }
+
+    void join() {
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    std::thread::id id() const { return m_thread.get_id(); }
+private:
+    std::thread m_thread;
+};
+
+}
@@ -0,0 +1,195 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cassert>
+#include "chrono.hpp"
+#include "shrink.hpp"
+
+namespace xec {
+
+// a priority queue of timed elements, where the elements live in stable slots
+// the heap itself only consists of (time, slot) pairs and each slot knows its position in the heap
+// this allows erasing or rescheduling an element by its slot in O(log n) instead of a scan and a rebuild of the heap
+// the positions in the heap are kept apart from the values, so heap operations don't touch the values at all
+template <typename T>
+class IndexedTimedQueue {
+public:
+    using slot_t = uint32_t;
+    static constexpr slot_t npos = slot_t(-1);
+
+    IndexedTimedQueue() = default;
+    explicit IndexedTimedQueue(std::pmr::memory_resource* resource)
+        : m_heap(resource)
+        , m_values(resource)
+        , m_heapIndices(resource)
+        , m_freeSlots(resource)
+    {}
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+
+    clock_t::time_point topTime() const { return m_heap.front().time; }
+    slot_t topSlot() const { return m_heap.front().slot; }
+
+    T& operator[](slot_t s) { return m_values[s]; }
+    const T& operator[](slot_t s) const { return m_values[s]; }
+
+    clock_t::time_point time(slot_t s) const { return m_heap[m_heapIndices[s]].time; }
+
+    // slots are in [0, numSlots)
+    // users can keep additional per-element data in their own arrays indexed by slot
+    slot_t numSlots() const { return slot_t(m_values.size()); }
+
+    // the slots up to the last one in use (the free ones after it can be dropped by shrink)
+    slot_t numUsedSlots() const { return m_numUsedSlots; }
+
+    slot_t push(clock_t::time_point time, T value) {
+        slot_t s;
+        if (m_freeSlots.empty()) {
+            s = slot_t(m_values.size());
+            m_values.push_back(std::move(value));
+            m_heapIndices.push_back(npos);
+        }
+        else {
+            std::pop_heap(m_freeSlots.begin(), m_freeSlots.end(), std::greater<slot_t>{});
+            s = m_freeSlots.back();
+            m_freeSlots.pop_back();
+            m_values[s] = std::move(value);
+        }
+        // free slots are reused lowest first, so a new slot is at most one past the used ones
+        m_numUsedSlots = std::max(m_numUsedSlots, s + 1);
+        m_heap.push_back({time, s});
+        siftUp(m_heap.size() - 1);
+        return s;
+    }
+
+    // remove the element from the queue and return its value
+    T extract(slot_t s) {
+        const auto i = m_heapIndices[s];
+        assert(i != npos);
+        T ret = std::move(m_values[s]);
+        m_values[s] = T{}; // don't keep anything alive in free slots
+        m_heapIndices[s] = npos;
+        m_freeSlots.push_back(s);
+        std::push_heap(m_freeSlots.begin(), m_freeSlots.end(), std::greater<slot_t>{});
+        while (m_numUsedSlots && m_heapIndices[m_numUsedSlots - 1] == npos) --m_numUsedSlots;
+        eraseAt(i);
+        return ret;
+    }
+
+    T pop() { return extract(topSlot()); }
+
+    void reschedule(slot_t s, clock_t::time_point newTime) {
+        const auto i = m_heapIndices[s];
+        assert(i != npos);
+        const auto oldTime = m_heap[i].time;
+        m_heap[i].time = newTime;
+        if (newTime < oldTime) siftUp(i);
+        else siftDown(i);
+    }
+
+    // linear search for an element
+    template <typename F>
+    slot_t find(F&& f) const {
+        for (slot_t s = 0; s < slot_t(m_values.size()); ++s) {
+            if (m_heapIndices[s] != npos && f(m_values[s])) return s;
+        }
+        return npos;
+    }
+
+    void clear() {
+        m_heap.clear();
+        m_values.clear();
+        m_heapIndices.clear();
+        m_freeSlots.clear();
+        m_numUsedSlots = 0;
+    }
+
+    // drop the free slots at the end and reduce the capacities to the given one (but not below what's used)
+    // slots in use are never moved, so the number of slots can only be reduced down to the last one in use
+    void shrink(size_t capacity) {
+        const size_t numSlots = m_numUsedSlots;
+        if (numSlots < m_values.size()) {
+            m_values.resize(numSlots);
+            m_heapIndices.resize(numSlots);
+            m_freeSlots.erase(std::remove_if(m_freeSlots.begin(), m_freeSlots.end(),
+                [numSlots](slot_t s) { return s >= numSlots; }), m_freeSlots.end());
+            std::make_heap(m_freeSlots.begin(), m_freeSlots.end(), std::greater<slot_t>{});
+        }
+        shrinkCapacity(m_heap, capacity);
+        shrinkCapacity(m_values, capacity);
+        shrinkCapacity(m_heapIndices, capacity);
+        shrinkCapacity(m_freeSlots, capacity);
+    }
+
+    size_t capacity() const { return m_values.capacity(); }
+
+    size_t reservedBytes() const {
+        return m_heap.capacity() * sizeof(HeapEntry)
+            + m_values.capacity() * sizeof(T)
+            + m_heapIndices.capacity() * sizeof(slot_t)
+            + m_freeSlots.capacity() * sizeof(slot_t);
+    }
+
+private:
+    struct HeapEntry {
+        clock_t::time_point time;
+        slot_t slot;
+    };
+    std::pmr::vector<HeapEntry> m_heap;
+
+    // by slot
+    std::pmr::vector<T> m_values;
+    std::pmr::vector<slot_t> m_heapIndices; // npos for free slots
+    std::pmr::vector<slot_t> m_freeSlots; // a min-heap, so the lowest free slots are reused first and the used ones stay packed
+    slot_t m_numUsedSlots = 0;
+
+    void place(size_t i, const HeapEntry& e) {
+        m_heap[i] = e;
+        m_heapIndices[e.slot] = slot_t(i);
+    }
+
+    void siftUp(size_t i) {
+        const auto e = m_heap[i];
+        while (i > 0) {
+            const auto parent = (i - 1) / 2;
+            if (!(e.time < m_heap[parent].time)) break;
+            place(i, m_heap[parent]);
+            i = parent;
+        }
+        place(i, e);
+    }
+
+    void siftDown(size_t i) {
+        const auto e = m_heap[i];
+        const auto size = m_heap.size();
+        while (true) {
+            auto child = 2 * i + 1;
+            if (child >= size) break;
+            if (child + 1 < size && m_heap[child + 1].time < m_heap[child].time) ++child;
+            if (!(m_heap[child].time < e.time)) break;
+            place(i, m_heap[child]);
+            i = child;
+        }
+        place(i, e);
+    }
+
+    void eraseAt(size_t i) {
+        const auto last = m_heap.back();
+        m_heap.pop_back();
+        if (i == m_heap.size()) return; // erased the last one
+
+        const auto erasedTime = m_heap[i].time;
+        m_heap[i] = last;
+        if (last.time < erasedTime) siftUp(i);
+        else siftDown(i);
+    }
+};
+
+} // namespace xec
@@ -3,8 +3,10 @@
 //
 #pragma once
 #include <queue>
+#include <algorithm>
 #include <vector>
 #include <optional>
+#include <memory_resource>
 #include "chrono.hpp"
 
 namespace xec {
@@ -18,8 +20,15 @@ struct TimedElementLater {
 
 template <typename T>
 struct TimedQueue
-    : public std::priority_queue<T, std::vector<T>, TimedElementLater<T>>
+    : public std::priority_queue<T, std::pmr::vector<T>, TimedElementLater<T>>
 {
+    using Base = std::priority_queue<T, std::pmr::vector<T>, TimedElementLater<T>>;
+
+    TimedQueue() = default;
+    explicit TimedQueue(std::pmr::memory_resource* resource)
+        : Base(TimedElementLater<T>{}, std::pmr::vector<T>(resource))
+    {}
+
     template <typename F>
     std::optional<T> tryExtract(F&& f) {
         auto& c = this->c;
@@ -7,4 +7,16 @@
 namespace xec {
 using clock_t = std::chrono::steady_clock;
 using ms_t = std::chrono::milliseconds;
+
+// round a time point up to the next multiple of the slack (counted from the epoch of the clock)
+// all times within a window of the slack are rounded to the same point, so timers which are due close to each other
+// can be fired together (including timers of different executors)
+inline clock_t::time_point applyTimerSlack(clock_t::time_point t, ms_t slack) {
+    if (slack <= ms_t(0)) return t;
+    const auto s = std::chrono::duration_cast<clock_t::duration>(slack);
+    auto rem = t.time_since_epoch() % s;
+    if (rem < clock_t::duration::zero()) rem += s;
+    if (rem == clock_t::duration::zero()) return t;
+    return t + (s - rem);
+}
 }
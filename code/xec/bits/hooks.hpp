@@ -0,0 +1,20 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "../Hooks.hpp"
+
+// internal selection of the instrumentation hooks
+// see Hooks.hpp for the public interface
+
+#if defined(XEC_HOOKS_HEADER)
+#   include XEC_HOOKS_HEADER
+#endif
+
+namespace xec {
+#if defined(XEC_HOOKS)
+using Hooks = XEC_HOOKS;
+#else
+using Hooks = DefaultHooks;
+#endif
+}
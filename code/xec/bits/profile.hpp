@@ -0,0 +1,26 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "../TaskProfiling.hpp"
+#include "chrono.hpp"
+
+#include <atomic>
+
+// internal interface of task profiling
+// see TaskProfiling.hpp for the public one
+
+namespace xec::profile {
+
+extern std::atomic_bool g_enabled;
+
+// enqueue time of a task pushed now
+// null if profiling is disabled, so we don't pay for reading the clock
+inline clock_t::time_point enqueueTime() {
+    return g_enabled.load(std::memory_order_relaxed) ? clock_t::now() : clock_t::time_point{};
+}
+
+// add to the stats of this thread
+void record(const TaskSite& site, std::chrono::nanoseconds time, std::chrono::nanoseconds queueDelay);
+
+}
@@ -0,0 +1,23 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+
+namespace xec {
+
+// reduce the capacity of a vector to the given one (but not below its size)
+// unlike shrink_to_fit, this is binding and keeps some room for growth
+template <typename Vec>
+void shrinkCapacity(Vec& v, size_t capacity) {
+    capacity = std::max(capacity, v.size());
+    if (v.capacity() <= capacity) return;
+    Vec shrunk(v.get_allocator());
+    shrunk.reserve(capacity);
+    std::move(v.begin(), v.end(), std::back_inserter(shrunk));
+    v.swap(shrunk);
+}
+
+} // namespace xec
@@ -0,0 +1,39 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// internal trace points
+// see Tracing.hpp for the public interface
+
+namespace xec::trace {
+
+enum class EventType : uint8_t {
+    UpdateBegin,
+    UpdateEnd,
+    TaskBegin,
+    TaskEnd,
+    WakeUpNow,
+    ScheduleWakeUp,
+    DispatchContext,
+    DispatchStrand,
+};
+
+extern std::atomic_bool g_enabled;
+
+void record(EventType type, const void* object, uint64_t a, uint64_t b);
+
+}
+
+#if XEC_TRACING
+#   define XEC_TRACE(type, object, a, b) \
+        do { \
+            if (::xec::trace::g_enabled.load(std::memory_order_relaxed)) { \
+                ::xec::trace::record(::xec::trace::EventType::type, object, uint64_t(a), uint64_t(b)); \
+            } \
+        } while (false)
+#else
+#   define XEC_TRACE(type, object, a, b) ((void)0)
+#endif
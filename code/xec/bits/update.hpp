@@ -0,0 +1,36 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "../ExecutorBase.hpp"
+#include "../Heartbeat.hpp"
+#include "trace.hpp"
+#include "hooks.hpp"
+
+namespace xec {
+
+// update an executor from an execution loop along with the optional instrumentation
+inline void updateExecutor(ExecutorBase& executor) {
+    XEC_TRACE(UpdateBegin, &executor, 0, 0);
+    auto heartbeat = executor.heartbeat();
+    if (heartbeat) heartbeat->beginUpdate();
+    Hooks::beforeUpdate(executor);
+
+    executor.update();
+
+    Hooks::afterUpdate(executor);
+    if (heartbeat) heartbeat->endUpdate();
+    XEC_TRACE(UpdateEnd, &executor, 0, 0);
+}
+
+// the loop of an execution which owns a context with a blocking wait
+template <typename Context>
+void runExecutionLoop(Context& context, ExecutorBase& executor) {
+    while (context.running()) {
+        context.wait();
+        updateExecutor(executor);
+    }
+    executor.finalize();
+}
+
+}
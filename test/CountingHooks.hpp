@@ -0,0 +1,59 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <xec/Hooks.hpp>
+
+#include <atomic>
+
+// hooks which count their calls
+// the library of t-Hooks is built with this as its XEC_HOOKS_HEADER (see CMakeLists.txt)
+
+struct HookCounters {
+    std::atomic_uint32_t beforeUpdate = 0;
+    std::atomic_uint32_t afterUpdate = 0;
+    std::atomic_uint32_t beforeTask = 0;
+    std::atomic_uint32_t afterTask = 0;
+    std::atomic_uint32_t enqueue = 0;
+    std::atomic_uint32_t wakeUp = 0;
+    std::atomic_uint32_t scheduleWakeUp = 0;
+    std::atomic_uint32_t beforeStrandTask = 0;
+    std::atomic_uint32_t afterStrandTask = 0;
+    std::atomic_uint32_t strandPost = 0;
+
+    // of the last executed task, so the sites can be checked
+    std::atomic_uint32_t lastTaskLine = 0;
+
+    void reset() {
+        beforeUpdate = afterUpdate = 0;
+        beforeTask = afterTask = 0;
+        enqueue = 0;
+        wakeUp = scheduleWakeUp = 0;
+        beforeStrandTask = afterStrandTask = strandPost = 0;
+        lastTaskLine = 0;
+    }
+};
+inline HookCounters hookCounters;
+
+struct CountingHooks : public xec::DefaultHooks {
+    static void beforeUpdate(const xec::ExecutorBase&) { ++hookCounters.beforeUpdate; }
+    static void afterUpdate(const xec::ExecutorBase&) { ++hookCounters.afterUpdate; }
+
+    static constexpr bool keepTaskSites = true;
+    static void beforeTask(const xec::TaskExecutor&, uint32_t, uint32_t, const xec::TaskSite&) { ++hookCounters.beforeTask; }
+    static void afterTask(const xec::TaskExecutor&, uint32_t, uint32_t, const xec::TaskSite& site) {
+        ++hookCounters.afterTask;
+        hookCounters.lastTaskLine = site.line;
+    }
+
+    static void onEnqueue(const xec::TaskExecutor&, uint32_t, uint32_t, const xec::TaskSite&, xec::ms_t) { ++hookCounters.enqueue; }
+
+    static void onWakeUp(const xec::ExecutorBase&) { ++hookCounters.wakeUp; }
+    static void onScheduleWakeUp(const xec::ExecutorBase&, xec::ms_t) { ++hookCounters.scheduleWakeUp; }
+
+    static void beforeStrandTask(const xec::Strand&) { ++hookCounters.beforeStrandTask; }
+    static void afterStrandTask(const xec::Strand&) { ++hookCounters.afterStrandTask; }
+    static void onStrandPost(const xec::Strand&) { ++hookCounters.strandPost; }
+};
+
+#define XEC_HOOKS CountingHooks
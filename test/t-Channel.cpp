@@ -0,0 +1,120 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/Channel.hpp>
+#include <xec/TaskExecutor.hpp>
+#include <xec/ThreadExecution.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+
+TEST_SUITE_BEGIN("Channel");
+
+namespace {
+class Consumer : public xec::TaskExecutor {
+public:
+    xec::Channel<std::string> channel;
+    size_t maxBatch = size_t(-1);
+
+    std::atomic_int numUpdates = 0;
+    std::atomic_size_t numMessages = 0;
+    std::atomic_size_t totalLength = 0;
+
+    Consumer(size_t capacity) : channel(*this, capacity) {}
+
+    virtual void update() override {
+        ++numUpdates;
+        channel.drain([&](std::string& msg) {
+            ++numMessages;
+            totalLength += msg.length();
+        }, maxBatch);
+        TaskExecutor::update();
+    }
+};
+}
+
+TEST_CASE("basic") {
+    Consumer c(3);
+    CHECK(c.channel.capacity() == 4);
+    CHECK(c.channel.empty());
+
+    CHECK(c.channel.tryPush("a"));
+    CHECK(c.channel.tryPush(std::string("bb")));
+    CHECK(c.channel.tryEmplace(3, 'c'));
+    CHECK(c.channel.tryPush("dddd"));
+    CHECK_FALSE(c.channel.tryPush("full"));
+
+    auto msg = c.channel.tryPop();
+    REQUIRE(msg);
+    CHECK(*msg == "a");
+
+    c.update();
+    CHECK(c.numMessages == 3);
+    CHECK(c.totalLength == 9);
+    CHECK(c.channel.empty());
+    CHECK_FALSE(c.channel.tryPop());
+}
+
+TEST_CASE("batches") {
+    Consumer c(16);
+    c.maxBatch = 4;
+    for (int i = 0; i < 10; ++i) {
+        CHECK(c.channel.tryPush("x"));
+    }
+
+    xec::ThreadExecution execution(c);
+    execution.launchThread();
+    while (c.numMessages < 10) std::this_thread::yield();
+    CHECK(c.numUpdates >= 3); // the consumer wakes itself up after a full batch
+    execution.stopAndJoinThread();
+}
+
+TEST_CASE("exact batches") {
+    Consumer c(16);
+    c.maxBatch = 4;
+    for (int i = 0; i < 8; ++i) {
+        CHECK(c.channel.tryPush("x"));
+    }
+
+    xec::ThreadExecution execution(c);
+    execution.launchThread();
+    while (c.numMessages < 8) std::this_thread::yield();
+
+    // the last batch reached the limit just as the channel became empty, so it must have armed the wake up
+    CHECK(c.channel.tryPush("x"));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (c.numMessages < 9 && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+    CHECK(c.numMessages == 9);
+
+    execution.stopAndJoinThread();
+}
+
+TEST_CASE("producers") {
+    Consumer c(64);
+    xec::ThreadExecution execution(c);
+    execution.launchThread();
+
+    constexpr int numProducers = 4;
+    constexpr int numPerProducer = 10000;
+    std::vector<std::thread> producers;
+    for (int i = 0; i < numProducers; ++i) {
+        producers.emplace_back([&] {
+            for (int m = 0; m < numPerProducer; ++m) {
+                while (!c.channel.tryPush("msg")) std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& p : producers) p.join();
+
+    while (c.numMessages < numProducers * numPerProducer) std::this_thread::yield();
+    CHECK(c.totalLength == 3 * numProducers * numPerProducer);
+
+    // wake ups only happen when the channel becomes non-empty, so there are far fewer updates than messages
+    CHECK(c.numUpdates < numProducers * numPerProducer);
+
+    execution.stopAndJoinThread();
+}
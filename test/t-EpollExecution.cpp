@@ -0,0 +1,70 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/EpollExecution.hpp>
+#include <xec/TaskExecutor.hpp>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("EpollExecution");
+
+TEST_CASE("fds, tasks and timers") {
+    int pipeFds[2];
+    REQUIRE(pipe(pipeFds) == 0);
+
+    xec::TaskExecutor executor;
+    xec::EpollExecution execution(executor);
+
+    std::vector<char> received; // only touched on the execution thread
+    std::atomic_int numReceived = 0;
+    std::atomic_int numTasks = 0;
+
+    REQUIRE(execution.context().addFd(pipeFds[0], EPOLLIN, [&](uint32_t events) {
+        CHECK((events & EPOLLIN));
+        char buf[16];
+        auto r = read(pipeFds[0], buf, sizeof(buf));
+        REQUIRE(r > 0);
+
+        // feed the executor
+        executor.pushTask([&, data = std::vector<char>(buf, buf + r)] {
+            received.insert(received.end(), data.begin(), data.end());
+            numReceived += int(data.size());
+        });
+    }));
+
+    execution.launchThread();
+
+    REQUIRE(write(pipeFds[1], "ab", 2) == 2);
+    while (numReceived != 2) std::this_thread::yield();
+
+    executor.pushTask([&] { ++numTasks; });
+    executor.scheduleTask(xec::ms_t(30), [&] { ++numTasks; });
+
+    REQUIRE(write(pipeFds[1], "cd", 2) == 2);
+    while (numReceived != 4 || numTasks != 2) std::this_thread::yield();
+
+    // removing from the execution thread
+    executor.pushTask([&] {
+        CHECK(execution.context().removeFd(pipeFds[0]));
+        ++numTasks;
+    });
+    while (numTasks != 3) std::this_thread::yield();
+
+    REQUIRE(write(pipeFds[1], "ef", 2) == 2);
+    executor.scheduleTask(xec::ms_t(30), [&] { ++numTasks; });
+    while (numTasks != 4) std::this_thread::yield();
+
+    execution.stopAndJoinThread();
+
+    CHECK(numReceived == 4);
+    CHECK(received == std::vector<char>{'a', 'b', 'c', 'd'});
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
@@ -0,0 +1,86 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include "CountingHooks.hpp"
+
+#include <xec/TaskExecutor.hpp>
+#include <xec/SimulatedExecution.hpp>
+#include <xec/PoolExecution.hpp>
+#include <xec/Strand.hpp>
+
+#include <atomic>
+#include <thread>
+
+TEST_SUITE_BEGIN("Hooks");
+
+TEST_CASE("task executor") {
+    using namespace std::chrono_literals;
+    auto& c = hookCounters;
+
+    xec::TaskExecutor executor;
+    xec::SimulatedExecution sim(executor);
+    sim.runUntilIdle();
+    c.reset();
+
+    int n = 0;
+    executor.pushTask([&] { ++n; });
+    CHECK(c.enqueue == 1);
+    CHECK(c.wakeUp == 1);
+
+    const auto site = xec::TaskSite::current();
+    executor.scheduleTask(100ms, [&] { ++n; }, 0, 0, site);
+    CHECK(c.enqueue == 2);
+
+    // one update for the pushed task and one for the scheduled one
+    CHECK(sim.runUntilIdle() == 2);
+    CHECK(n == 2);
+    CHECK(c.beforeUpdate == 2);
+    CHECK(c.afterUpdate == 2);
+    CHECK(c.beforeTask == 2);
+    CHECK(c.afterTask == 2);
+    CHECK(c.scheduleWakeUp > 0);
+
+    // profiling is disabled, but the hooks keep the sites
+    CHECK(c.lastTaskLine == site.line);
+}
+
+TEST_CASE("replaced task") {
+    auto& c = hookCounters;
+
+    xec::TaskExecutor executor;
+    c.reset();
+
+    const auto id = executor.pushOrReplaceTask([] {}, 1);
+    const auto site = xec::TaskSite::current();
+    CHECK(executor.pushOrReplaceTask([] {}, 1, site) == id);
+
+    // both are reported as enqueues, but only the replacement is executed
+    CHECK(c.enqueue == 2);
+    executor.update();
+    CHECK(c.afterTask == 1);
+    CHECK(c.lastTaskLine == site.line);
+}
+
+TEST_CASE("strand") {
+    auto& c = hookCounters;
+
+    xec::PoolExecution pool;
+    pool.launchThreads(2);
+    c.reset();
+
+    constexpr uint32_t numTasks = 100;
+    std::atomic_uint32_t numExecuted = 0;
+    xec::Strand strand(pool);
+    for (uint32_t i = 0; i < numTasks; ++i) {
+        strand.post([&] { ++numExecuted; });
+    }
+    CHECK(c.strandPost == numTasks);
+
+    while (numExecuted != numTasks) std::this_thread::yield();
+    pool.stopAndJoinThreads();
+
+    CHECK(c.beforeStrandTask == numTasks);
+    CHECK(c.afterStrandTask == numTasks);
+    CHECK(c.beforeTask == 0);
+}
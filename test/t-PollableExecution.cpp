@@ -0,0 +1,82 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/PollableExecution.hpp>
+#include <xec/TaskExecutor.hpp>
+
+#include <poll.h>
+
+#include <atomic>
+#include <thread>
+
+TEST_SUITE_BEGIN("PollableExecution");
+
+namespace {
+// a minimal foreign loop
+bool fdReadable(int fd, int timeout) {
+    pollfd pfd = {};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return ::poll(&pfd, 1, timeout) == 1;
+}
+}
+
+TEST_CASE("foreign loop") {
+    xec::TaskExecutor executor;
+    xec::PollableExecution execution(executor);
+    const int fd = execution.fd();
+
+    // initially readable as we start with work to do
+    CHECK(fdReadable(fd, 0));
+    CHECK(execution.runReady());
+    CHECK_FALSE(fdReadable(fd, 0));
+
+    int numTasks = 0; // only touched in the loop on this thread
+
+    // tasks pushed from this thread
+    executor.pushTask([&] { ++numTasks; });
+    CHECK(fdReadable(fd, 0));
+    CHECK(execution.runReady());
+    CHECK(numTasks == 1);
+    CHECK_FALSE(fdReadable(fd, 0));
+
+    // timers
+    executor.scheduleTask(xec::ms_t(50), [&] { ++numTasks; });
+    CHECK(execution.runReady()); // just schedules the wake up
+    CHECK(numTasks == 1);
+    CHECK_FALSE(fdReadable(fd, 0));
+    CHECK(fdReadable(fd, 1000));
+    CHECK(execution.runReady());
+    CHECK(numTasks == 2);
+    CHECK_FALSE(fdReadable(fd, 0));
+
+    // cancelling doesn't wake up the executor, so the stale timer will fire, but it's harmless
+    auto id = executor.scheduleTask(xec::ms_t(50), [&] { ++numTasks; });
+    CHECK(execution.runReady());
+    CHECK(executor.cancelTask(id));
+    CHECK(fdReadable(fd, 1000));
+    CHECK(execution.runReady());
+    CHECK(numTasks == 2);
+    CHECK_FALSE(fdReadable(fd, 100));
+
+    // tasks pushed from other threads
+    std::thread producer([&] {
+        for (int i = 0; i < 100; ++i) {
+            executor.pushTask([&] { ++numTasks; });
+        }
+    });
+    while (numTasks != 102) {
+        if (fdReadable(fd, 1000)) {
+            CHECK(execution.runReady());
+        }
+    }
+    producer.join();
+
+    executor.pushTask([&] { ++numTasks; }); // will be left unexecuted
+    executor.stop();
+    CHECK(fdReadable(fd, 0));
+    CHECK_FALSE(execution.runReady());
+    CHECK_FALSE(execution.runReady());
+    CHECK(numTasks == 102);
+}
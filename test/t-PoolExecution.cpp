@@ -0,0 +1,349 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/PoolExecution.hpp>
+#include <xec/TaskExecutor.hpp>
+#include <xec/ThreadExecution.hpp>
+#include <xec/Strand.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <future>
+#include <memory_resource>
+
+TEST_SUITE_BEGIN("PoolExecution");
+
+static std::thread::id workerThreadId(xec::PoolExecution& pool) {
+    xec::Strand strand(pool);
+    std::atomic<std::thread::id> id;
+    strand.post([&] { id = std::this_thread::get_id(); });
+    while (!strand.idle()) std::this_thread::yield();
+    return id;
+}
+
+TEST_CASE("stop with executors") {
+    xec::TaskExecutor e1, e2;
+    e1.setFinishTasksOnExit(true);
+    std::atomic_int i = 0;
+    e1.pushTask([&] { ++i; });
+
+    xec::PoolExecution pool;
+    pool.addExecutor(e1);
+    pool.addExecutor(e2);
+    pool.launchThreads(2);
+    pool.stopAndJoinThreads();
+
+    CHECK(i == 1);
+}
+
+TEST_CASE("migrate") {
+    xec::TaskExecutor e;
+    e.setFinishTasksOnExit(true);
+
+    xec::PoolExecution a, b;
+    a.launchThreads(1);
+    b.launchThreads(1);
+    const auto aid = workerThreadId(a);
+    const auto bid = workerThreadId(b);
+
+    a.addExecutor(e);
+
+    std::atomic<std::thread::id> immediate, scheduled;
+    e.pushTask([&] { immediate = std::this_thread::get_id(); });
+    while (immediate == std::thread::id{}) std::this_thread::yield();
+    CHECK(immediate == aid);
+
+    e.scheduleTask(xec::ms_t(50), [&] { scheduled = std::this_thread::get_id(); });
+
+    CHECK(a.migrateExecutor(e, b));
+    CHECK_FALSE(a.removeExecutor(e)); // no longer there
+
+    while (scheduled == std::thread::id{}) std::this_thread::yield();
+    CHECK(scheduled == bid);
+
+    a.stopAndJoinThreads();
+    b.stopAndJoinThreads();
+}
+
+TEST_CASE("remove to thread") {
+    xec::TaskExecutor e;
+
+    xec::PoolExecution pool;
+    pool.launchThreads(2);
+    pool.addExecutor(e);
+
+    std::atomic_int i = 0;
+    e.pushTask([&] { ++i; });
+    while (i == 0) std::this_thread::yield();
+
+    CHECK(pool.removeExecutor(e));
+
+    // pushed while detached
+    e.pushTask([&] { ++i; });
+
+    xec::ThreadExecution thread(e);
+    thread.launchThread();
+    while (i == 1) std::this_thread::yield();
+
+    pool.stopAndJoinThreads(); // the pool doesn't own it anymore
+
+    e.pushTask([&] { ++i; });
+    while (i == 2) std::this_thread::yield();
+
+    thread.stopAndJoinThread();
+    CHECK(i == 3);
+}
+
+TEST_CASE("remove during stop") {
+    struct Executor : public xec::TaskExecutor {
+        std::atomic_int numFinalizes = 0;
+        virtual void finalize() override {
+            ++numFinalizes;
+            TaskExecutor::finalize();
+        }
+    };
+    Executor e;
+
+    xec::PoolExecution pool;
+    pool.launchThreads(2);
+    pool.addExecutor(e);
+
+    // keep the executor updating, so the remover has to wait for it
+    std::atomic_bool updating = false, release = false;
+    e.pushTask([&] {
+        updating = true;
+        while (!release) std::this_thread::yield();
+    });
+    while (!updating) std::this_thread::yield();
+
+    auto removed = std::async(std::launch::async, [&] { return pool.removeExecutor(e); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); // let it start waiting
+
+    // the executor is skipped when claiming for finalization, as it's active
+    auto stopped = pool.stopAsync();
+    release = true;
+
+    // the pool has been stopped, so it's not removed, but finalized
+    CHECK_FALSE(removed.get());
+    stopped.wait();
+    CHECK(e.numFinalizes == 1);
+
+    pool.joinThreads();
+}
+
+TEST_CASE("timer slack") {
+    std::vector<xec::TaskExecutor> executors(10);
+
+    xec::PoolExecution pool;
+    pool.setTimerSlack(xec::ms_t(200));
+    pool.launchThreads(2);
+
+    std::atomic_int done = 0;
+    for (auto& e : executors) {
+        pool.addExecutor(e);
+    }
+    for (size_t i = 0; i < executors.size(); ++i) {
+        executors[i].scheduleTask(xec::ms_t(50 + i), [&] { ++done; });
+    }
+    while (done < int(executors.size())) std::this_thread::yield();
+
+    auto stats = pool.timerStats();
+    CHECK(stats.numTimedWakeUps == executors.size());
+    // all wake ups are within 10 ms, so they're in a single window of the slack, or rarely two
+    CHECK(stats.numTimerFires <= 2);
+
+    pool.stopAndJoinThreads();
+}
+
+TEST_CASE("earliest deadline first") {
+    xec::TaskExecutor a, b, c;
+    a.setLatencyTarget(xec::ms_t(1000));
+    b.setLatencyTarget(xec::ms_t(10));
+    // c uses the default target of the pool
+
+    xec::PoolExecution pool;
+    pool.setDispatchPolicy(xec::PoolExecution::DispatchPolicy::EarliestDeadline, xec::ms_t(200));
+
+    std::mutex mutex;
+    std::vector<char> order;
+    auto record = [&](char name) {
+        std::lock_guard<std::mutex> lk(mutex);
+        order.push_back(name);
+    };
+    a.pushTask([&] { record('a'); });
+    b.pushTask([&] { record('b'); });
+    c.pushTask([&] { record('c'); });
+
+    // all are pending before there are workers
+    pool.addExecutor(a);
+    pool.addExecutor(c);
+    pool.addExecutor(b);
+    pool.launchThreads(1);
+
+    while (true) {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (order.size() == 3) break;
+    }
+    CHECK(order == std::vector<char>{'b', 'c', 'a'});
+
+    pool.stopAndJoinThreads();
+}
+
+TEST_CASE("deadline misses") {
+    xec::TaskExecutor slow, urgent;
+    urgent.setLatencyTarget(xec::ms_t(5));
+
+    xec::PoolExecution pool;
+    pool.addExecutor(slow);
+    pool.addExecutor(urgent);
+    pool.launchThreads(1);
+
+    std::atomic_bool slowStarted = false, urgentDone = false;
+    slow.pushTask([&] {
+        slowStarted = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    });
+    while (!slowStarted) std::this_thread::yield();
+
+    // the only worker is busy, so this can't be served in time
+    urgent.pushTask([&] { urgentDone = true; });
+    while (!urgentDone) std::this_thread::yield();
+
+    auto stats = pool.deadlineStats();
+    CHECK(stats.numDispatches >= 1); // the wake up on add may be merged with the one of the task
+    CHECK(stats.numMisses >= 1);
+    CHECK(stats.maxLateness >= std::chrono::milliseconds(10));
+
+    pool.stopAndJoinThreads();
+}
+
+TEST_CASE("affinity") {
+    xec::TaskExecutor a, b;
+
+    xec::PoolExecution pool;
+    pool.setAffinityThreshold(xec::ms_t(1000));
+    pool.launchThreads(4);
+    pool.addExecutor(a, 1 << 2);
+    pool.addExecutor(b, 1 << 2);
+
+    auto runOn = [](xec::TaskExecutor& e) {
+        std::atomic<std::thread::id> id;
+        e.pushTask([&] { id = std::this_thread::get_id(); });
+        while (id == std::thread::id{}) std::this_thread::yield();
+        return id.load();
+    };
+
+    runOn(a); // the first update may happen on any worker, if the preferred one hasn't started yet
+    const auto worker = runOn(a);
+    for (int i = 0; i < 20; ++i) {
+        CHECK(runOn(a) == worker);
+        CHECK(runOn(b) == worker);
+    }
+    const auto migrationsBefore = pool.executorStats(a)->numMigrations;
+    CHECK(migrationsBefore <= 2);
+
+    // when the preferred worker is busy for too long, another one takes over
+    // the preferred one is kept busy until the other one has taken over, so this doesn't depend on timing
+    pool.setAffinityThreshold(xec::ms_t(50));
+    std::atomic_bool bStarted = false, bRelease = false;
+    b.pushTask([&] {
+        bStarted = true;
+        while (!bRelease) std::this_thread::yield();
+    });
+    while (!bStarted) std::this_thread::yield();
+
+    CHECK(runOn(a) != worker);
+    bRelease = true;
+    CHECK(pool.executorStats(a)->numMigrations == migrationsBefore + 1);
+
+    xec::TaskExecutor other;
+    CHECK_FALSE(pool.executorStats(other));
+
+    pool.stopAndJoinThreads();
+}
+
+TEST_CASE("stop async") {
+    constexpr int numExecutors = 5000;
+    std::vector<xec::TaskExecutor> executors(numExecutors);
+    std::atomic_int numExecuted = 0;
+
+    xec::PoolExecution pool;
+    pool.launchThreads(4);
+    for (auto& e : executors) {
+        e.setFinishTasksOnExit(true);
+        pool.addExecutor(e);
+        e.pushTask([&] { ++numExecuted; });
+    }
+
+    auto done = pool.stopAsync();
+    done.wait();
+    CHECK(numExecuted == numExecutors);
+
+    // stopping again gives the same future
+    CHECK(pool.stopAsync().wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+
+    pool.joinThreads();
+}
+
+TEST_CASE("memory resource") {
+    // all allocations happen under the lock of the pool, so the resource doesn't need to be thread safe
+    std::pmr::unsynchronized_pool_resource resource;
+
+    constexpr int numExecutors = 1000;
+    std::vector<xec::TaskExecutor> executors(numExecutors);
+    std::atomic_int numExecuted = 0;
+    {
+        xec::PoolExecution pool(&resource);
+        pool.launchThreads(3);
+        for (auto& e : executors) {
+            pool.addExecutor(e);
+            e.pushTask([&] { ++numExecuted; });
+            e.scheduleTask(xec::ms_t(30), [&] { ++numExecuted; });
+        }
+        while (numExecuted != 2 * numExecutors) std::this_thread::yield();
+        pool.stopAndJoinThreads();
+    }
+}
+
+TEST_CASE("blocking") {
+    using namespace std::chrono_literals;
+
+    // outside of a pool this just calls the function
+    CHECK(xec::blocking([] { return 5; }) == 5);
+
+    xec::PoolExecution pool;
+    pool.launchThreads(1);
+    const auto workerId = workerThreadId(pool);
+
+    xec::TaskExecutor a, b;
+    pool.addExecutor(a);
+    pool.addExecutor(b);
+
+    std::vector<std::thread::id> compensatingIds;
+    for (int i = 0; i < 2; ++i) {
+        std::promise<std::thread::id> result;
+        a.pushTask([&] {
+            // the only worker is blocked here, so the task of b can only be executed by a compensating worker
+            auto id = xec::blocking([&] {
+                auto bid = std::make_shared<std::promise<std::thread::id>>();
+                auto f = bid->get_future();
+                b.pushTask([bid] { bid->set_value(std::this_thread::get_id()); });
+                return f.wait_for(5s) == std::future_status::ready ? f.get() : std::thread::id{};
+            });
+            result.set_value(id);
+        });
+        compensatingIds.push_back(result.get_future().get());
+
+        // the compensating worker retires when the region ends
+        while (pool.numWorkers() != 1) std::this_thread::yield();
+    }
+
+    CHECK(compensatingIds[0] != std::thread::id{});
+    CHECK(compensatingIds[0] != workerId);
+    CHECK(compensatingIds[1] == compensatingIds[0]); // parked and reused
+
+    pool.stopAndJoinThreads();
+}
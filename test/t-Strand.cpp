@@ -0,0 +1,86 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/Strand.hpp>
+#include <xec/PoolExecution.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+
+TEST_SUITE_BEGIN("Strand");
+
+struct Session {
+    Session(xec::PoolExecution& pool) : strand(pool) {}
+    xec::Strand strand;
+    std::atomic_bool executing = false;
+    bool overlapped = false; // only touched by tasks of the strand
+    std::vector<int> order[2]; // per producer
+};
+
+TEST_CASE("serialized execution") {
+    xec::PoolExecution pool;
+    pool.launchThreads(4);
+
+    constexpr int numSessions = 200;
+    constexpr int tasksPerProducer = 100;
+
+    std::vector<std::unique_ptr<Session>> sessions;
+    for (int i = 0; i < numSessions; ++i) {
+        sessions.push_back(std::make_unique<Session>(pool));
+    }
+
+    std::atomic_int numExecuted = 0;
+
+    auto produce = [&](int producer) {
+        for (int i = 0; i < tasksPerProducer; ++i) {
+            for (auto& s : sessions) {
+                s->strand.post([&numExecuted, s = s.get(), producer, i] {
+                    if (s->executing.exchange(true)) s->overlapped = true;
+                    s->order[producer].push_back(i);
+                    s->executing = false;
+                    ++numExecuted;
+                });
+            }
+        }
+    };
+
+    std::thread p0(produce, 0);
+    std::thread p1(produce, 1);
+    p0.join();
+    p1.join();
+
+    while (numExecuted != numSessions * tasksPerProducer * 2) std::this_thread::yield();
+
+    // a worker releases a strand only after its last task has returned, so join before checking for idle
+    pool.stopAndJoinThreads();
+
+    for (auto& s : sessions) {
+        CHECK(s->strand.idle());
+        CHECK_FALSE(s->overlapped);
+        for (auto& order : s->order) {
+            REQUIRE(order.size() == tasksPerProducer);
+            for (int i = 0; i < tasksPerProducer; ++i) {
+                CHECK(order[i] == i);
+            }
+        }
+    }
+}
+
+TEST_CASE("post from task") {
+    xec::PoolExecution pool;
+    pool.launchThreads(2);
+
+    xec::Strand strand(pool);
+    std::atomic_int i = 0;
+    strand.post([&] {
+        ++i;
+        strand.post([&] { ++i; });
+    });
+
+    while (i != 2) std::this_thread::yield();
+    pool.stopAndJoinThreads();
+    CHECK(strand.idle());
+}
@@ -9,6 +9,9 @@
 #include <vector>
 #include <functional>
 #include <numeric>
+#include <thread>
+#include <atomic>
+#include <memory_resource>
 
 TEST_SUITE_BEGIN("TaskExecutor");
 
@@ -313,3 +316,264 @@ TEST_CASE("initial context") {
         CHECK(i == 0);
     }
 }
+
+TEST_CASE("capacity") {
+    using OP = xec::TaskExecutor::OverflowPolicy;
+    std::vector<int> executed;
+    auto push = [&](xec::TaskExecutor& te, int i, xec::TaskExecutor::task_ctoken token = 0) {
+        return te.tryPushTask([&executed, i] { executed.push_back(i); }, token);
+    };
+
+    SUBCASE("reject") {
+        xec::TaskExecutor te;
+        te.setCapacity(3, OP::Reject);
+        CHECK(push(te, 1) != xec::TaskExecutor::invalid_task_id);
+        CHECK(push(te, 2) != xec::TaskExecutor::invalid_task_id);
+        CHECK(push(te, 3) != xec::TaskExecutor::invalid_task_id);
+        CHECK(te.queueDepth() == 3);
+        CHECK(push(te, 4) == xec::TaskExecutor::invalid_task_id);
+        CHECK(te.queueDepth() == 3);
+        te.update();
+        CHECK(executed == std::vector<int>{1, 2, 3});
+        CHECK(te.queueDepth() == 0);
+    }
+
+    SUBCASE("drop oldest") {
+        xec::TaskExecutor te;
+        te.setCapacity(3, OP::DropOldest);
+        for (int i = 1; i <= 5; ++i) {
+            CHECK(push(te, i) != xec::TaskExecutor::invalid_task_id);
+        }
+        CHECK(te.queueDepth() == 3);
+        te.update();
+        CHECK(executed == std::vector<int>{3, 4, 5});
+    }
+
+    SUBCASE("sustained drop oldest") {
+        xec::TaskExecutor te;
+        te.setCapacity(10, OP::DropOldest);
+        for (int i = 1; i <= 100'000; ++i) {
+            push(te, i, i % 3 + 1);
+        }
+        CHECK(te.queueDepth() == 10);
+
+        // the token chains are intact after compaction
+        CHECK(te.cancelTasksWithToken(1) == 3); // 99'993, 99'996, 99'999
+        te.update();
+        CHECK(executed == std::vector<int>{99'991, 99'992, 99'994, 99'995, 99'997, 99'998, 100'000});
+
+        // the dropped tasks don't pile up in the queue
+        CHECK(te.reservedBytes() < 64 * 1024);
+    }
+
+    SUBCASE("coalesce") {
+        xec::TaskExecutor te;
+        te.setCapacity(3, OP::Coalesce);
+        push(te, 1, 1);
+        push(te, 2, 2);
+        push(te, 3, 1);
+        CHECK(push(te, 4, 1) != xec::TaskExecutor::invalid_task_id); // coalesces 1 and 3
+        CHECK(push(te, 5, 3) != xec::TaskExecutor::invalid_task_id);
+        CHECK(push(te, 6) == xec::TaskExecutor::invalid_task_id);
+        CHECK(push(te, 7, 4) == xec::TaskExecutor::invalid_task_id);
+        CHECK(push(te, 8, 3) != xec::TaskExecutor::invalid_task_id); // coalesces 5
+        te.update();
+        CHECK(executed == std::vector<int>{2, 4, 8});
+    }
+
+    SUBCASE("block") {
+        xec::TaskExecutor te;
+        te.setCapacity(2, OP::Block);
+        std::atomic_int sum = 0;
+        std::atomic_size_t maxDepth = 0;
+
+        xec::ThreadExecution exec(te);
+        exec.launchThread();
+
+        std::thread producer([&] {
+            for (int i = 1; i <= 100; ++i) {
+                te.pushTask([&, i] { sum += i; });
+                auto depth = te.queueDepth();
+                if (depth > maxDepth) maxDepth = depth;
+            }
+        });
+        producer.join();
+
+        while (sum != 5050) std::this_thread::yield();
+        CHECK(maxDepth <= 2);
+    }
+}
+
+TEST_CASE("pushOrReplaceTask") {
+    std::vector<int> executed;
+    auto task = [&executed](int i) {
+        return [&executed, i] { executed.push_back(i); };
+    };
+
+    xec::TaskExecutor te;
+    auto id1 = te.pushOrReplaceTask(task(1), 1);
+    te.pushTask(task(2));
+    auto id3 = te.pushOrReplaceTask(task(3), 3);
+    CHECK(te.pushOrReplaceTask(task(4), 1) == id1);
+    te.pushTask(task(5), 5);
+    CHECK(te.pushOrReplaceTask(task(6), 3) == id3);
+    CHECK(te.pushOrReplaceTask(task(7), 1) == id1);
+    CHECK(te.queueDepth() == 4);
+
+    // erasing from the middle of the queue must keep the index valid
+    CHECK(te.cancelTasksWithToken(5) == 1);
+    CHECK(te.pushOrReplaceTask(task(8), 3) == id3);
+
+    te.update();
+    CHECK(executed == std::vector<int>{7, 2, 8});
+
+    // after execution there's nothing to replace
+    executed.clear();
+    CHECK(te.pushOrReplaceTask(task(9), 1) != id1);
+    te.update();
+    CHECK(executed == std::vector<int>{9});
+}
+
+TEST_CASE("SubmissionBuffer") {
+    std::vector<std::pair<int, xec::TaskExecutor::task_id>> executed;
+
+    xec::TaskExecutor te;
+    te.pushTask([&] { executed.push_back({0, 0}); });
+
+    std::vector<xec::TaskExecutor::task_id> ids;
+    {
+        auto buf = te.submissionBuffer(4);
+        for (int i = 1; i <= 6; ++i) {
+            auto id = std::make_shared<xec::TaskExecutor::task_id>();
+            *id = buf.pushTask([&executed, i, id] { executed.push_back({i, *id}); });
+            ids.push_back(*id);
+        }
+
+        // the first 4 have been flushed on reaching the threshold
+        CHECK(buf.size() == 2);
+        CHECK(te.queueDepth() == 5);
+
+        // can't cancel before flushing
+        CHECK_FALSE(te.cancelTask(ids[5]));
+
+        // pushing directly while the buffer holds tasks
+        te.pushTask([&] { executed.push_back({7, 0}); });
+    }
+    CHECK(te.queueDepth() == 8);
+
+    CHECK(te.cancelTask(ids[5]));
+
+    te.update();
+    REQUIRE(executed.size() == 7);
+    CHECK(executed[0].first == 0);
+    for (int i = 1; i <= 4; ++i) {
+        CHECK(executed[i].first == i);
+        CHECK(executed[i].second == ids[i - 1]);
+    }
+    CHECK(executed[5].first == 7);
+    CHECK(executed[6].first == 5);
+    CHECK(executed[6].second == ids[4]);
+
+    // ordering per producer
+    executed.clear();
+    {
+        xec::ThreadExecution exec(te);
+        exec.launchThread();
+
+        std::vector<int> received[2];
+        std::atomic_int numReceived = 0;
+        auto producer = [&](int p) {
+            auto buf = te.submissionBuffer(16);
+            for (int i = 0; i < 1000; ++i) {
+                buf.pushTask([&, p, i] { received[p].push_back(i); ++numReceived; });
+            }
+        };
+        std::thread a(producer, 0), b(producer, 1);
+        a.join();
+        b.join();
+        while (numReceived != 2000) std::this_thread::yield();
+
+        std::vector<int> expected(1000);
+        std::iota(expected.begin(), expected.end(), 0);
+        CHECK(received[0] == expected);
+        CHECK(received[1] == expected);
+    }
+}
+
+namespace {
+// counts the memory it gives, so we can check that it's used and that everything is returned
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t numAllocations = 0;
+    size_t bytesInUse = 0;
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        ++numAllocations;
+        bytesInUse += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        bytesInUse -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+}
+
+TEST_CASE("memory resource") {
+    CountingResource resource;
+    {
+        xec::TaskExecutor te(xec::ms_t(20), &resource);
+
+        int n = 0;
+        {
+            auto t = te.taskLocker();
+            for (uint32_t i = 0; i < 100; ++i) {
+                t.pushTask([&] { ++n; }, 1 + i % 3);
+                t.scheduleTask(xec::ms_t(1000), [&] { n += 1000; }, 1 + i % 3);
+            }
+        }
+        CHECK(resource.numAllocations > 0);
+
+        te.update();
+        CHECK(n == 100);
+        CHECK(te.cancelTasksWithToken(1) == 34);
+        te.finalize();
+    }
+    CHECK(resource.bytesInUse == 0);
+}
+
+TEST_CASE("recycled staged tasks") {
+    CountingResource resource;
+    {
+        xec::TaskExecutor te(xec::ms_t(20), &resource);
+
+        int n = 0;
+        std::vector<xec::TaskExecutor::task_id> ids;
+        auto scheduleAndCancel = [&] {
+            for (int i = 0; i < 10; ++i) {
+                ids.push_back(te.scheduleTask(xec::ms_t(1000), [&] { ++n; }));
+            }
+            for (auto id : ids) {
+                CHECK(te.cancelTask(id));
+            }
+            ids.clear();
+        };
+
+        // the nodes of staged tasks are allocated from the resource
+        ids.push_back(te.scheduleTask(xec::ms_t(1000), [&] { ++n; }));
+        CHECK(resource.numAllocations > 0);
+
+        // the first round allocates everything else, the rest reuse it
+        scheduleAndCancel();
+        const auto numAllocations = resource.numAllocations;
+        for (int i = 0; i < 100; ++i) {
+            scheduleAndCancel();
+        }
+        CHECK(resource.numAllocations == numAllocations);
+        CHECK(n == 0);
+    }
+    CHECK(resource.bytesInUse == 0);
+}
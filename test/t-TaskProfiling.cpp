@@ -0,0 +1,162 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/TaskExecutor.hpp>
+#include <xec/ThreadExecution.hpp>
+#include <xec/SimulatedExecution.hpp>
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstring>
+
+TEST_SUITE_BEGIN("TaskProfiling");
+
+using namespace std::chrono_literals;
+
+namespace {
+const xec::profile::SiteStats* find(const std::vector<xec::profile::SiteStats>& stats, const char* file, uint32_t line) {
+    for (auto& s : stats) {
+        if (s.site.line == line && std::strcmp(s.site.file, file) == 0) return &s;
+    }
+    return nullptr;
+}
+}
+
+TEST_CASE("sites") {
+    xec::profile::reset();
+
+    std::atomic_int numTasks = 0;
+    uint32_t loopLine = 0, slowLine = 0, scheduledLine = 0;
+    {
+        xec::TaskExecutor executor;
+        xec::ThreadExecution execution(executor);
+
+        execution.launchThread();
+
+        executor.pushTask([&] { ++numTasks; }); // not profiled
+        while (numTasks != 1) std::this_thread::yield();
+
+        xec::profile::enable();
+
+        {
+            auto locker = executor.taskLocker();
+            for (int i = 0; i < 10; ++i) {
+                loopLine = __LINE__; locker.pushTask([&] { ++numTasks; });
+            }
+            slowLine = __LINE__; locker.pushTask([&] { std::this_thread::sleep_for(10ms); ++numTasks; });
+            locker.pushTask([&] { ++numTasks; }, 0, 0, xec::TaskSite::tag("tagged"));
+        }
+        scheduledLine = __LINE__; executor.scheduleTask(30ms, [&] { ++numTasks; });
+
+        while (numTasks != 14) std::this_thread::yield();
+
+        xec::profile::enable(false);
+        executor.pushTask([&] { ++numTasks; }); // not profiled
+        while (numTasks != 15) std::this_thread::yield();
+    }
+
+    auto stats = xec::profile::collect();
+    REQUIRE(stats.size() == 4);
+
+    // sorted by total time
+    CHECK(stats.front().site.line == slowLine);
+    CHECK(stats.front().count == 1);
+    CHECK(stats.front().totalTime >= 10ms);
+    CHECK(stats.front().maxTime == stats.front().totalTime);
+
+    auto loop = find(stats, __FILE__, loopLine);
+    REQUIRE(loop);
+    CHECK(loop->count == 10);
+    CHECK(loop->maxTime <= loop->totalTime);
+    CHECK(loop->maxQueueDelay > 0ns); // pushed while the tasks were locked
+
+    auto tagged = find(stats, "tagged", 0);
+    REQUIRE(tagged);
+    CHECK(tagged->count == 1);
+
+    auto scheduled = find(stats, __FILE__, scheduledLine);
+    REQUIRE(scheduled);
+    CHECK(scheduled->count == 1);
+    CHECK(scheduled->totalQueueDelay < 30ms); // measured from the time it was scheduled for
+
+    xec::profile::reset();
+    CHECK(xec::profile::collect().empty());
+}
+
+TEST_CASE("pushed while disabled") {
+    xec::profile::reset();
+
+    auto pushAndUpdate = [](xec::TaskExecutor& executor) {
+        for (int i = 0; i < 1000; ++i) {
+            executor.pushTask([] {});
+        }
+        executor.update();
+        return executor.reservedBytes();
+    };
+
+    xec::TaskExecutor a, b;
+    const auto unprofiledBytes = pushAndUpdate(a);
+
+    xec::profile::enable();
+    const auto profiledBytes = pushAndUpdate(b);
+
+    // executed while enabled, but pushed while disabled, so it's not profiled
+    xec::profile::enable(false);
+    a.pushTask([] {});
+    xec::profile::enable();
+    a.update();
+    xec::profile::enable(false);
+
+    // queued tasks only carry the profiling data when it's used
+    CHECK(unprofiledBytes < profiledBytes);
+
+    auto stats = xec::profile::collect();
+    REQUIRE(stats.size() == 1);
+    CHECK(stats.front().count == 1000);
+
+    xec::profile::reset();
+}
+
+TEST_CASE("replaced") {
+    xec::profile::reset();
+
+    xec::TaskExecutor executor;
+    executor.pushOrReplaceTask([] {}, 1); // pushed while disabled
+
+    xec::profile::enable();
+    const auto site = xec::TaskSite::tag("replacement");
+    executor.pushOrReplaceTask([] {}, 1, site);
+    executor.update();
+    xec::profile::enable(false);
+
+    // the replacement is profiled with its own site
+    auto stats = xec::profile::collect();
+    REQUIRE(stats.size() == 1);
+    CHECK(std::strcmp(stats.front().site.file, "replacement") == 0);
+    CHECK(stats.front().count == 1);
+
+    xec::profile::reset();
+}
+
+TEST_CASE("simulated time") {
+    xec::profile::reset();
+    xec::profile::enable();
+
+    // the virtual clock is a day behind the real one
+    xec::TaskExecutor executor(xec::ms_t(0));
+    xec::SimulatedExecution sim(executor, xec::clock_t::now() - 24h);
+
+    uint32_t line = __LINE__; executor.scheduleTask(1h, [] {});
+    sim.runFor(2h);
+    xec::profile::enable(false);
+
+    auto stats = xec::profile::collect();
+    auto scheduled = find(stats, __FILE__, line);
+    REQUIRE(scheduled);
+    CHECK(scheduled->count == 1);
+    CHECK(scheduled->maxQueueDelay < 1h); // not mixing the virtual clock with the real one
+
+    xec::profile::reset();
+}
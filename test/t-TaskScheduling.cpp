@@ -4,8 +4,12 @@
 #include <doctest/doctest.h>
 #include <xec/TaskExecutor.hpp>
 #include <xec/ThreadExecution.hpp>
+#include <xec/SimulatedExecution.hpp>
 
 #include <atomic>
+#include <vector>
+#include <thread>
+#include <algorithm>
 
 TEST_SUITE_BEGIN("TaskScheduling");
 
@@ -115,3 +119,382 @@ TEST_CASE("reschedule") {
 
     CHECK(status.t2 == 1);
 }
+
+TEST_CASE("cancel scheduled") {
+    Executor xec;
+    std::atomic_int sum = 0;
+    std::atomic_bool done = false;
+
+    auto add = [&sum](int i) {
+        return [&sum, i] { sum += i; };
+    };
+
+    xec::TaskExecutor::task_id toCancel;
+    {
+        auto t = xec.taskLocker();
+        for (int i = 0; i < 10; ++i) {
+            t.scheduleTask(std::chrono::milliseconds(30 + i), add(1), 1);
+            t.scheduleTask(std::chrono::milliseconds(30 + i), add(10), 2);
+            toCancel = t.scheduleTask(std::chrono::milliseconds(30 + i), add(100), 3);
+        }
+        t.scheduleTask(std::chrono::milliseconds(60), [&] { done = true; });
+    }
+
+    CHECK(xec.cancelTasksWithToken(2) == 10);
+    CHECK(xec.cancelTasksWithToken(2) == 0);
+    CHECK(xec.cancelTask(toCancel));
+    CHECK_FALSE(xec.cancelTask(toCancel));
+
+    while (!done) std::this_thread::yield();
+    xec.e.stopAndJoinThread();
+
+    CHECK(sum == 10 + 900);
+}
+
+TEST_CASE("simulated time") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor(xec::ms_t(0));
+    const auto start = xec::clock_t::time_point{} + 1000h;
+    xec::SimulatedExecution sim(executor, start);
+    CHECK(sim.now() == start);
+
+    std::vector<xec::clock_t::duration> executed;
+
+    // an hourly task for a day
+    struct Hourly {
+        xec::TaskExecutor& executor;
+        xec::SimulatedExecution& sim;
+        std::vector<xec::clock_t::duration>& executed;
+        xec::clock_t::time_point start;
+        void operator()() {
+            executed.push_back(sim.now() - start);
+            if (executed.size() < 25) { // 24 of these and the one from below
+                executor.scheduleTask(1h, Hourly(*this));
+            }
+        }
+    };
+    executor.scheduleTask(1h, Hourly{executor, sim, executed, start});
+    executor.scheduleTask(90min, [&] { executed.push_back(sim.now() - start); });
+
+    CHECK(sim.runUntil(start + 150min) > 0);
+    CHECK(sim.now() == start + 150min);
+    REQUIRE(executed.size() == 3);
+    CHECK(executed[0] == 1h);
+    CHECK(executed[1] == 90min);
+    CHECK(executed[2] == 2h);
+
+    sim.runUntilIdle();
+    REQUIRE(executed.size() == 25);
+    CHECK(executed.back() == 24h);
+    CHECK(sim.now() == start + 24h);
+
+    auto id = executor.scheduleTask(10min, [&] { executed.push_back(sim.now() - start); });
+    CHECK(executor.rescheduleTask(5min, id));
+    sim.runFor(1h);
+    REQUIRE(executed.size() == 26);
+    CHECK(executed.back() == 24h + 5min);
+    CHECK(sim.now() == start + 25h);
+
+    executor.scheduleTask(1min, [&] { executed.push_back(sim.now() - start); });
+    executor.stop();
+    sim.runUntilIdle();
+    CHECK(sim.finalized());
+    CHECK(executed.size() == 26);
+}
+
+TEST_CASE("timer slack") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor(xec::ms_t(0));
+    const auto start = xec::clock_t::time_point{} + 1000h; // a multiple of the slack below
+    xec::SimulatedExecution sim(executor, start);
+
+    int numEarly = 0;
+    xec::clock_t::duration maxLate{};
+    auto scheduleBatch = [&] {
+        for (int i = 1; i <= 100; ++i) {
+            const auto due = sim.now() + xec::ms_t(i);
+            executor.scheduleTask(xec::ms_t(i), [&, due] {
+                if (sim.now() < due) ++numEarly;
+                maxLate = std::max(maxLate, sim.now() - due);
+            });
+        }
+        sim.runUntilIdle();
+    };
+
+    scheduleBatch();
+    CHECK(executor.timerStats().numTimerFires == 100);
+    CHECK(executor.timerStats().numTimedTasks == 100);
+    CHECK(maxLate == xec::clock_t::duration{});
+
+    executor.setTimerSlack(50ms);
+    scheduleBatch();
+    CHECK(executor.timerStats().numTimerFires == 102); // 100 ms worth of tasks in two windows
+    CHECK(executor.timerStats().numTimedTasks == 200);
+    CHECK(maxLate == 49ms);
+    CHECK(numEarly == 0);
+}
+
+TEST_CASE("drain on exit") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor;
+    executor.setDrainOnExit(100ms, 10s);
+
+    std::vector<int> executed;
+    {
+        auto t = executor.taskLocker();
+        t.pushTask([&] { executed.push_back(1); });
+        t.scheduleTask(500ms, [&] { executed.push_back(500); }); // after the grace period
+        t.scheduleTask(50ms, [&] { executed.push_back(50); });
+        t.pushTask([&] {
+            executed.push_back(2);
+            executor.pushTask([&] { executed.push_back(3); });
+        });
+    }
+
+    // finalize on this thread (the executor has no execution)
+    executor.finalize();
+    CHECK(executed == std::vector<int>{1, 2, 50, 3});
+
+    auto& report = executor.drainReport();
+    CHECK(report.numExecuted == 4);
+    CHECK(report.numDropped == 1);
+    CHECK_FALSE(report.deadlineReached);
+    CHECK(report.duration < 50ms); // scheduled tasks are not waited for
+}
+
+TEST_CASE("drain deadline") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor;
+    executor.setDrainOnExit(0ms, 200ms);
+
+    // the first task outlasts the deadline, so the others are dropped
+    // the margins are wide, so scheduler jitter doesn't change the outcome:
+    // the first task would have to be delayed by 200ms to be dropped as well
+    std::atomic_int numExecuted = 0;
+    executor.pushTask([&] {
+        ++numExecuted;
+        std::this_thread::sleep_for(250ms);
+    });
+    for (int i = 0; i < 2; ++i) {
+        executor.pushTask([&] { ++numExecuted; });
+    }
+
+    executor.finalize();
+    CHECK(numExecuted == 1);
+
+    auto& report = executor.drainReport();
+    CHECK(report.numExecuted == 1);
+    CHECK(report.numDropped == 2);
+    CHECK(report.deadlineReached);
+    CHECK(report.duration >= 200ms);
+}
+
+TEST_CASE("staged scheduling") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor;
+    xec::SimulatedExecution sim(executor);
+    sim.runUntilIdle();
+    const auto start = sim.now();
+
+    std::vector<int> executed;
+
+    // only tasks which are due before all others wake the executor up
+    executor.scheduleTask(100ms, [&] { executed.push_back(100); });
+    CHECK(sim.runUntil(start) == 1);
+    for (int i = 0; i < 10; ++i) {
+        executor.scheduleTask(200ms + xec::ms_t(i), [&, i] { executed.push_back(200 + i); });
+    }
+    CHECK(sim.runUntil(start) == 0);
+    executor.scheduleTask(50ms, [&] { executed.push_back(50); });
+    CHECK(sim.runUntil(start) == 1);
+
+    // staged tasks can be canceled and rescheduled
+    auto id = executor.scheduleTask(300ms, [&] { executed.push_back(300); });
+    CHECK(executor.cancelTask(id));
+    id = executor.scheduleTask(400ms, [&] { executed.push_back(400); });
+    CHECK(executor.rescheduleTask(80ms, id));
+
+    sim.runUntilIdle();
+    CHECK(executed == std::vector<int>{50, 400, 100, 200, 201, 202, 203, 204, 205, 206, 207, 208, 209});
+}
+
+TEST_CASE("concurrent scheduling") {
+    Executor executor;
+
+    constexpr int numProducers = 4;
+    constexpr int numTasks = 500;
+    std::atomic_int numExecuted = 0;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < numTasks; ++i) {
+                executor.scheduleTask(xec::ms_t(20 + (i * 7 + p) % 30), [&] { ++numExecuted; });
+            }
+        });
+    }
+    for (auto& p : producers) p.join();
+
+    while (numExecuted != numProducers * numTasks) {
+        std::this_thread::yield();
+    }
+
+    executor.e.stopAndJoinThread();
+}
+
+TEST_CASE("shrink policy") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor;
+    xec::SimulatedExecution sim(executor);
+    executor.setShrinkPolicy(1s);
+
+    int n = 0;
+    auto burst = [&](int count) {
+        auto t = executor.taskLocker();
+        for (int i = 0; i < count; ++i) {
+            t.pushTask([&] { ++n; });
+            t.scheduleTask(xec::ms_t(100 + i % 500), [&] { ++n; });
+        }
+    };
+
+    burst(10000);
+    sim.runFor(600ms);
+    CHECK(n == 20000);
+    const auto peak = executor.reservedBytes();
+    CHECK(peak > 10000 * 3 * sizeof(xec::TaskExecutor::Task));
+
+    // the peak is within the sliding window, so nothing is shrunk
+    for (int i = 0; i < 2; ++i) {
+        burst(10);
+        sim.runFor(1s);
+        CHECK(executor.reservedBytes() == peak);
+    }
+    CHECK(n == 20000 + 2 * 20);
+
+    // now the peak is out of the window
+    // the executor is idle, but it wakes up to shrink its containers without any new tasks
+    const auto numUpdates = sim.runFor(1s);
+    CHECK(numUpdates > 0);
+    CHECK(executor.reservedBytes() < peak / 50);
+
+    // once shrunk, it no longer wakes up
+    CHECK(sim.runFor(10s) == 0);
+
+    // the containers still work after shrinking
+    burst(1000);
+    sim.runUntilIdle();
+    CHECK(n == 20000 + 2 * 20 + 2 * 1000);
+}
+
+TEST_CASE("shrink with a task in a high slot") {
+    using namespace std::chrono_literals;
+
+    xec::TaskExecutor executor;
+    xec::SimulatedExecution sim(executor);
+    executor.setShrinkPolicy(1s);
+
+    int n = 0;
+    {
+        auto t = executor.taskLocker();
+        for (int i = 0; i < 10000; ++i) {
+            t.scheduleTask(xec::ms_t(100), [&] { ++n; });
+        }
+        // takes the slot after all others and outlives the windows
+        t.scheduleTask(1h, [&] { ++n; });
+    }
+    sim.runFor(200ms);
+    CHECK(n == 10000);
+
+    // the slot can't be moved, so the capacity up to it is kept...
+    sim.runFor(3s);
+    const auto reserved = executor.reservedBytes();
+    CHECK(reserved > 10000 * sizeof(xec::TaskExecutor::Task));
+
+    // ...and the executor doesn't keep waking up to release it
+    CHECK(sim.runFor(10s) == 0);
+    CHECK(executor.reservedBytes() == reserved);
+
+    sim.runUntilIdle();
+    CHECK(n == 10001);
+}
+
+TEST_CASE("shrink staged tasks") {
+    using namespace std::chrono_literals;
+
+    // the same burst of scheduled tasks, staged or not, so the only difference in memory is the staged tasks
+    xec::TaskExecutor staged, locked;
+    xec::SimulatedExecution stagedSim(staged), lockedSim(locked);
+    staged.setShrinkPolicy(1s);
+    locked.setShrinkPolicy(1s);
+
+    int n = 0;
+    for (int i = 0; i < 1000; ++i) {
+        staged.scheduleTask(100ms, [&] { ++n; });
+    }
+    {
+        auto t = locked.taskLocker();
+        for (int i = 0; i < 1000; ++i) {
+            t.scheduleTask(100ms, [&] { ++n; });
+        }
+    }
+
+    stagedSim.runFor(200ms);
+    lockedSim.runFor(200ms);
+    CHECK(n == 2000);
+
+    // the nodes of the staged tasks are counted
+    const auto peakDiff = staged.reservedBytes() - locked.reservedBytes();
+    CHECK(staged.reservedBytes() > locked.reservedBytes() + 1000 * sizeof(xec::TaskExecutor::Task));
+
+    // and released once the burst is out of the window, though the executor is idle
+    stagedSim.runFor(5s);
+    lockedSim.runFor(5s);
+    CHECK(staged.reservedBytes() - locked.reservedBytes() < peakDiff / 10);
+
+    // staging still works after that
+    for (int i = 0; i < 100; ++i) {
+        staged.scheduleTask(100ms, [&] { ++n; });
+    }
+    stagedSim.runFor(200ms);
+    CHECK(n == 2100);
+}
+
+TEST_CASE("concurrent scheduling while shrinking") {
+    Executor executor;
+    executor.setShrinkPolicy(xec::ms_t(1)); // shrink as often as possible
+
+    constexpr int numProducers = 4;
+    constexpr int numBursts = 20;
+    constexpr int burstSize = 1000;
+    std::atomic_int numExecuted = 0;
+
+    // bursts with pauses of different lengths, so the staged tasks keep growing and shrinking
+    // while some producers are staging
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int b = 0; b < numBursts; ++b) {
+                const int size = b % 4 ? burstSize / 10 : burstSize;
+                for (int i = 0; i < size; ++i) {
+                    // only the first one is due before the others and wakes the executor up, so the rest pile up
+                    executor.scheduleTask(xec::ms_t(20), [&] { ++numExecuted; });
+                }
+                std::this_thread::sleep_for(xec::ms_t(2 + p * 3));
+            }
+        });
+    }
+    for (auto& p : producers) p.join();
+
+    const int numTasks = numProducers * (numBursts / 4) * (burstSize + 3 * burstSize / 10);
+    while (numExecuted != numTasks) {
+        std::this_thread::yield();
+    }
+
+    executor.e.stopAndJoinThread();
+}
@@ -0,0 +1,105 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/Tracing.hpp>
+#include <xec/TaskExecutor.hpp>
+#include <xec/ThreadExecution.hpp>
+#include <xec/PoolExecution.hpp>
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <string>
+#include <vector>
+
+TEST_SUITE_BEGIN("Tracing");
+
+namespace {
+size_t count(const std::string& str, const std::string& substr) {
+    size_t ret = 0;
+    for (auto p = str.find(substr); p != std::string::npos; p = str.find(substr, p + 1)) {
+        ++ret;
+    }
+    return ret;
+}
+
+std::string dump() {
+    std::ostringstream out;
+    xec::trace::writeChromeTrace(out);
+    return out.str();
+}
+}
+
+TEST_CASE("chrome trace") {
+    xec::trace::clear();
+
+    // tracing is only toggled while no thread executes, so no span is cut in half (see Tracing.hpp)
+    std::atomic_int numTasks = 0;
+    auto runTasks = [&](const char* threadName, std::vector<xec::TaskExecutor::task_ctoken> tokens) {
+        xec::TaskExecutor executor;
+        xec::ThreadExecution execution(executor);
+        execution.launchThread(threadName);
+        const auto target = numTasks + int(tokens.size());
+        for (auto token : tokens) {
+            executor.pushTask([&] { ++numTasks; }, token);
+        }
+        while (numTasks != target) std::this_thread::yield();
+        execution.stopAndJoinThread();
+    };
+
+    // not enabled, not recorded
+    runTasks("untraced", {0});
+
+    xec::trace::enable();
+    runTasks("traced", {55, 0});
+    xec::trace::enable(false);
+
+    runTasks("untraced", {0});
+
+    auto trace = dump();
+    CHECK(trace.find("{\"traceEvents\":[") == 0);
+
+    if (!xec::trace::supported()) {
+        CHECK(count(trace, "\"ph\":\"B\"") == 0);
+        return;
+    }
+
+    CHECK(count(trace, "\"name\":\"task\"") == 4); // two begins and two ends
+    CHECK(count(trace, "\"ctoken\":55") == 1);
+    CHECK(count(trace, "\"name\":\"wakeUpNow\"") >= 2);
+    CHECK(count(trace, "\"name\":\"update\"") >= 2);
+    CHECK(count(trace, "\"name\":\"traced\"") == 1);
+    CHECK(count(trace, "\"name\":\"untraced\"") == 0);
+
+    xec::trace::clear();
+    trace = dump();
+    CHECK(count(trace, "\"name\":\"task\"") == 0);
+}
+
+TEST_CASE("pool dispatch") {
+    if (!xec::trace::supported()) return;
+
+    xec::trace::clear();
+    xec::trace::enable();
+
+    std::atomic_int numTasks = 0;
+    {
+        xec::PoolExecution pool;
+        xec::TaskExecutor a, b;
+        pool.addExecutor(a);
+        pool.addExecutor(b);
+        pool.launchThreads(2);
+
+        a.pushTask([&] { ++numTasks; });
+        b.pushTask([&] { ++numTasks; });
+        while (numTasks != 2) std::this_thread::yield();
+        pool.stopAndJoinThreads();
+    }
+    xec::trace::enable(false);
+
+    auto trace = dump();
+    CHECK(count(trace, "\"name\":\"dispatch\"") >= 2);
+    CHECK(count(trace, "\"name\":\"task\"") == 4);
+    xec::trace::clear();
+}
@@ -0,0 +1,146 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <xec/Watchdog.hpp>
+#include <xec/TaskExecutor.hpp>
+#include <xec/ThreadExecution.hpp>
+#include <xec/PoolExecution.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("Watchdog");
+
+using namespace std::chrono_literals;
+
+namespace {
+struct StallRecord {
+    xec::ExecutorBase* executor;
+    bool inTask;
+    uint32_t taskId;
+    uint32_t taskCToken;
+    xec::ms_t elapsed;
+};
+}
+
+TEST_CASE("stalled task") {
+    std::mutex mutex;
+    std::vector<StallRecord> stalls;
+
+    xec::Watchdog watchdog(20ms, [&](const xec::Watchdog::Stall& s) {
+        std::lock_guard<std::mutex> lk(mutex);
+        stalls.push_back({&s.executor, s.inTask, s.taskId, s.taskCToken, s.elapsed});
+    });
+
+    xec::TaskExecutor executor;
+    watchdog.watch(executor);
+
+    std::atomic_int numTasks = 0;
+    {
+        xec::ThreadExecution execution(executor);
+        execution.launchThread();
+
+        for (int i = 0; i < 10; ++i) {
+            executor.pushTask([&] { ++numTasks; });
+        }
+        auto slowId = executor.pushTask([&] {
+            std::this_thread::sleep_for(100ms);
+            ++numTasks;
+        }, 7);
+        executor.pushTask([&] { ++numTasks; });
+        while (numTasks != 12) std::this_thread::yield();
+
+        std::this_thread::sleep_for(30ms); // give the watchdog a chance to report anything wrongly
+
+        std::lock_guard<std::mutex> lk(mutex);
+        REQUIRE(stalls.size() == 1);
+        CHECK(stalls[0].executor == &executor);
+        CHECK(stalls[0].inTask);
+        CHECK(stalls[0].taskId == slowId);
+        CHECK(stalls[0].taskCToken == 7);
+        CHECK(stalls[0].elapsed >= 20ms);
+        CHECK(stalls[0].elapsed < 100ms);
+    }
+
+    CHECK(executor.heartbeat());
+    watchdog.unwatch(executor);
+    CHECK_FALSE(executor.heartbeat());
+}
+
+TEST_CASE("unwatch while reporting") {
+    std::atomic_bool reporting = false, release = false;
+    std::atomic_bool executorAlive = true;
+    std::atomic_bool reportedDead = false;
+
+    xec::Watchdog watchdog(20ms, [&](const xec::Watchdog::Stall&) {
+        reporting = true;
+        while (!release) std::this_thread::yield();
+        if (!executorAlive) reportedDead = true; // the stall refers to an unwatched executor
+    });
+
+    {
+        xec::TaskExecutor executor;
+        watchdog.watch(executor);
+        xec::ThreadExecution execution(executor);
+        execution.launchThread();
+        executor.pushTask([&] {
+            while (!reporting) std::this_thread::yield();
+        });
+        while (!reporting) std::this_thread::yield();
+
+        // the report is in progress, so unwatching has to wait for it
+        std::thread releaser([&] {
+            std::this_thread::sleep_for(30ms);
+            release = true;
+        });
+        watchdog.unwatch(executor);
+        CHECK(release);
+        executorAlive = false;
+        releaser.join();
+    }
+
+    CHECK_FALSE(reportedDead);
+}
+
+TEST_CASE("busy pool") {
+    xec::Watchdog watchdog(1000ms, [](const xec::Watchdog::Stall&) {}, 2ms);
+
+    xec::PoolExecution pool;
+    watchdog.watch(pool);
+
+    xec::TaskExecutor a, b;
+    pool.addExecutor(a);
+    pool.addExecutor(b);
+    pool.launchThreads(2);
+
+    while (pool.numWorkers() != 2) std::this_thread::yield();
+
+    std::atomic_bool release = false;
+    std::atomic_int numBlocked = 0;
+    auto block = [&] {
+        ++numBlocked;
+        while (!release) std::this_thread::yield();
+    };
+    a.pushTask(block);
+    b.pushTask(block);
+    while (numBlocked != 2) std::this_thread::yield();
+    CHECK(pool.numBusyWorkers() == 2);
+
+    std::this_thread::sleep_for(20ms);
+    release = true;
+
+    pool.stopAndJoinThreads();
+    CHECK(pool.numWorkers() == 0);
+
+    auto stats = watchdog.poolStats(pool);
+    CHECK(stats.numSamples > 0);
+    CHECK(stats.numAllBusySamples > 0);
+    CHECK(stats.numAllBusySamples <= stats.numSamples);
+    CHECK(stats.maxBusyWorkers == 2);
+
+    watchdog.unwatch(pool);
+    CHECK(watchdog.poolStats(pool).numSamples == 0);
+}